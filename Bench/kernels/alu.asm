@@ -0,0 +1,18 @@
+; tight loop of register arithmetic and logic, no memory access
+mov r7, ITERATIONS
+mov r6, 1
+mov r0, 1
+mov r1, 3
+mov r2, 5
+mov r3, 7
+alu_loop:
+    add r0, r1
+    xor r1, r0
+    sub r2, r1
+    and r3, r0
+    or  r3, r2
+    not r4, r3
+    add r4, r2
+    xor r5, r4
+    sub r7, r6
+    jnz alu_loop
@@ -0,0 +1,26 @@
+; short blocks ending in data dependent conditional jumps
+mov r7, ITERATIONS
+mov r6, 1
+mov r0, 12345
+mov r1, 6789
+mov r2, 1048576
+mov r3, 65536
+branchy_loop:
+    add r0, r1
+    xor r1, r0
+    mov r4, r0
+    and r4, r2
+    jz branchy_even
+    add r5, r6
+branchy_even:
+    mov r4, r1
+    and r4, r3
+    jnz branchy_odd
+    sub r5, r6
+branchy_odd:
+    cmp r0, r1
+    jg branchy_greater
+    xor r5, r0
+branchy_greater:
+    sub r7, r6
+    jnz branchy_loop
@@ -0,0 +1,17 @@
+; byte, word, dword and qword stores, each loaded back
+mov r7, ITERATIONS
+mov r6, 1
+mov r0, 0
+memory_loop:
+    mov  byte [sp],      r0
+    mov  word [sp + 8],  r0
+    mov dword [sp + 16], r0
+    mov qword [sp + 24], r0
+    mov r1,  byte [sp]
+    mov r2,  word [sp + 8]
+    mov r3, dword [sp + 16]
+    mov r4, qword [sp + 24]
+    add r0, r1
+    add r0, r4
+    sub r7, r6
+    jnz memory_loop
@@ -0,0 +1,16 @@
+; push and pop of every size
+mov r7, ITERATIONS
+mov r6, 1
+mov r0, 0
+pushpop_loop:
+    push qword r0
+    push dword r6
+    push  word r7
+    push  byte r0
+    pop   byte r1
+    pop   word r2
+    pop  dword r3
+    pop  qword r4
+    add r0, r1
+    sub r7, r6
+    jnz pushpop_loop
@@ -0,0 +1,29 @@
+; naive recursive fibonacci of 20, call and ret heavy
+mov r7, ITERATIONS
+mov r6, 1
+mov r5, 2
+recursion_loop:
+    mov r0, 20
+    call fib
+    sub r7, r6
+    jnz recursion_loop
+jmp end
+
+; r1 = fib(r0), r0 is preserved
+fib:
+    cmp r0, r5
+    jl fib_base
+    push qword r0
+    sub r0, r6
+    call fib
+    push qword r1
+    sub r0, r6
+    call fib
+    pop qword r2
+    add r1, r2
+    pop qword r0
+    ret
+fib_base:
+    mov r1, r0
+    ret
+end:
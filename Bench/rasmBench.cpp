@@ -0,0 +1,340 @@
+#include <new>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+
+#include "rasmCache.hpp"
+#include "rasmLexer.hpp"
+#include "rasmLinker.hpp"
+#include "rasmTranslator.hpp"
+
+#include "rvm.hpp"
+
+//
+//  Assembler benchmark: lexes source in memory with RasmLexer alone,
+//  translates it with RasmTranslator on one thread and on all cores, then
+//  rebuilds it as from cache: reads its object back and links it. Best of
+//  several runs each. Reports lines and bytes of source per second and heap
+//  allocations of one run as JSON. Fails if parallel translation differs
+//  from serial, or if program optimized (/O), compact (/v2) or both runs
+//  differently from plain one, or if damaged cache entry of source is not
+//  translated and written again. Sources of any size are made by rasmGen
+//
+//    rasmBench <source> [/repeat n]
+//
+
+//
+//  global operator new is replaced to count allocations
+//
+
+static uint64_t allocations = 0;
+static uint64_t allocatedBytes = 0;
+
+void* operator new(size_t size)
+{
+  ++allocations;
+  allocatedBytes += size;
+  if (auto p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+struct measure_t
+{
+  double seconds;
+  uint64_t allocations;
+  uint64_t bytes;
+};
+
+//
+//  best time of repeat runs, allocations of the last one
+//
+
+template <class Run>
+static measure_t measure(unsigned repeat, Run run)
+{
+  measure_t result{ std::chrono::duration<double>::max().count(), 0, 0 };
+  for (unsigned i = 0; i < repeat; i++) {
+    auto start = std::chrono::steady_clock::now();
+    auto startAllocations = allocations;
+    auto startBytes = allocatedBytes;
+    run();
+    std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+    result.seconds = std::min(result.seconds, time.count());
+    result.allocations = allocations - startAllocations;
+    result.bytes = allocatedBytes - startBytes;
+  }
+  return result;
+}
+
+//
+//  generated program may loop, its run is stopped after budget of basic
+//  blocks. Stack and data get memory beyond program
+//
+
+static constexpr uint64_t runBudget = 1000000;
+static constexpr uint64_t runMemory = 1 << 20;
+
+struct RunPolicy : RvmNoexceptPolicy
+{
+  using io_t = MemoryIo;
+};
+
+//
+//  Ip is left out, it is code address. Sp and Bp are kept relative to
+//  stack bottom, which is end of program
+//
+
+struct run_t
+{
+  bool finished;
+  bool ok;
+  std::string output;
+  uint64_t registers[RvmIsa::RegSize];
+};
+
+static run_t runFor(const std::vector<uint8_t>& program)
+{
+  Rvm<RunPolicy> vm{ program.size() + runMemory };
+  auto status = vm.load(program);
+  if (status.ok) {
+    status = vm.step(runBudget);
+  }
+  run_t run{ !status.ok || vm.finished(), status.ok, vm.io().sink(), {} };
+  for (uint8_t r = 0; r < RvmIsa::RegSize; r++) {
+    auto bottom = r == RvmIsa::Sp || r == RvmIsa::Bp ? program.size() : 0;
+    run.registers[r] = r == RvmIsa::Ip ? 0 : vm.reg(r) - bottom;
+  }
+  return run;
+}
+
+static void report(const char* name, const measure_t& m, uint64_t lines, uint64_t bytes, bool last)
+{
+  std::cout << "  \"" << name << "\": {"
+    << " \"seconds\": " << m.seconds << ","
+    << " \"lines_per_second\": " << lines / m.seconds << ","
+    << " \"bytes_per_second\": " << bytes / m.seconds << ","
+    << " \"allocations\": " << m.allocations << ","
+    << " \"allocated_bytes\": " << m.bytes << " }" << (last ? "\n" : ",\n");
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2 && !(argc == 4 && strcmp(argv[2], "/repeat") == 0)) {
+    std::cerr << "usage: rasmBench <source> [/repeat n]\n";
+    return 2;
+  }
+  unsigned repeat = argc == 4 ? std::max(std::stoul(argv[3]), 1ul) : 5;
+
+  try {
+    std::string source;
+    {
+      std::ifstream in{ argv[1], std::ifstream::in | std::ifstream::binary };
+      if (!in.is_open()) {
+        throw std::ios_base::failure{ std::string{ "could not open " } + argv[1] };
+      }
+      source.assign(std::istreambuf_iterator<char>{ in }, {});
+    }
+    uint64_t bytes = source.size();
+    uint64_t lines = std::count(source.begin(), source.end(), '\n');
+
+    //
+    //  lexer runs over source in memory, as translator does
+    //
+
+    uint64_t tokens = 0;
+    auto lex = measure(repeat, [&] {
+      RasmLexer lexer{ std::string_view{ source } };
+      tokens = 0;
+      while (lexer.getNextToken().type != RasmLexer::TokenType::Eof) {
+        ++tokens;
+      }
+    });
+
+    auto output = std::filesystem::temp_directory_path() / "rasmBench.bin";
+    bool ok = true;
+    auto translateOn = [&](unsigned threads) {
+      std::ifstream in{ argv[1] };
+      std::ofstream out{ output, std::ofstream::out | std::ofstream::binary };
+      RasmTranslator translator;
+      translator.threads(threads);
+      auto status = translator.translate(in, out);
+      if (!status) {
+        std::cerr << status;
+        ok = false;
+      }
+    };
+    auto read = [&] {
+      std::ifstream in{ output, std::ifstream::in | std::ifstream::binary };
+      return std::string{ std::istreambuf_iterator<char>{ in }, {} };
+    };
+    //
+    //  at least two threads, so chunked translation is checked on any machine
+    //
+
+    auto threads = std::max(std::thread::hardware_concurrency(), 2u);
+    auto translate = measure(repeat, [&] { translateOn(1); });
+    auto serial = read();
+    auto parallel = measure(repeat, [&] { translateOn(threads); });
+    auto same = read() == serial;
+    std::filesystem::remove(output);
+    if (!ok) {
+      return 1;
+    }
+    if (!same) {
+      std::cerr << "parallel translation differs from serial\n";
+      return 1;
+    }
+
+    //
+    //  registers are compared only if plain program finished without error:
+    //  writes which are dead after the error point may be removed by /O.
+    //  Program which doesn't finish within budget is not compared
+    //
+
+    auto assembleAs = [&](bool optimize, bool compact) {
+      std::vector<uint8_t> program;
+      RasmTranslator translator;
+      translator.optimize(optimize);
+      translator.compact(compact);
+      auto status = translator.translate(std::string_view{ source }, program);
+      if (!status) {
+        std::cerr << status;
+        ok = false;
+      }
+      return program;
+    };
+    auto plain = runFor(assembleAs(false, false));
+    bool alike = true;
+    if (plain.finished) {
+      for (auto [optimize, compact] : { std::pair{ true, false }, { false, true }, { true, true } }) {
+        auto run = runFor(assembleAs(optimize, compact));
+        alike = alike && run.finished && run.ok == plain.ok && run.output == plain.output
+          && (!plain.ok || std::equal(std::begin(run.registers), std::end(run.registers), plain.registers));
+      }
+    }
+    if (!ok) {
+      return 1;
+    }
+    if (!alike) {
+      std::cerr << "optimized or compact program runs differently from plain\n";
+      return 1;
+    }
+
+    std::string cached;
+    {
+      std::ifstream in{ argv[1] };
+      RasmObject object;
+      RasmTranslator translator;
+      translator.translate(in, object);
+      std::ostringstream out;
+      object.write(out);
+      cached = out.str();
+    }
+    auto link = measure(repeat, [&] {
+      std::istringstream in{ cached };
+      std::vector<RasmObject> objects(1);
+      std::ostringstream out;
+      RasmLinker linker;
+      if (!objects.front().read(in) || !linker.link(objects, out)) {
+        ok = false;
+      }
+    });
+    if (!ok) {
+      std::cerr << "could not link cached object\n";
+      return 1;
+    }
+
+    //
+    //  code size of cached module is spoiled to almost 4 GB, /l must take
+    //  such entry for a miss without allocating that much, translate source
+    //  again and rewrite entry, which is hit then
+    //
+
+    std::filesystem::path cacheDirectory{ "rasmBench-cache" };
+    std::filesystem::remove_all(cacheDirectory);
+    std::string fresh;
+    {
+      RasmCache cache{ cacheDirectory };
+      RasmObject object;
+      ok = cache.load(argv[1], object) && cache.misses() == 1;
+      std::ostringstream out;
+      object.write(out);
+      fresh = out.str();
+    }
+    constexpr auto codeSizeAt = sizeof(RasmCache::EntryHeader) + 2 + 8 + 32 + sizeof(RasmObject::ObjectHeader);
+    for (const auto& entry : std::filesystem::directory_iterator{ cacheDirectory }) {
+      std::fstream file{ entry.path(), std::fstream::in | std::fstream::out | std::fstream::binary };
+      file.seekp(codeSizeAt);
+      file.write("\xFF\xFF\xFF\xF0", 4);
+    }
+    {
+      RasmCache cache{ cacheDirectory };
+      RasmObject damaged;
+      RasmObject rewritten;
+      auto startBytes = allocatedBytes;
+      ok = ok && cache.load(argv[1], damaged);
+      ok = ok && allocatedBytes - startBytes < (uint64_t{ 1 } << 30);
+      ok = ok && cache.load(argv[1], rewritten) && cache.misses() == 1 && cache.hits() == 1;
+      std::ostringstream out;
+      damaged.write(out);
+      ok = ok && out.str() == fresh;
+    }
+    std::filesystem::remove_all(cacheDirectory);
+    if (!ok) {
+      std::cerr << "damaged cache entry is not translated and written again\n";
+      return 1;
+    }
+
+    std::cout << "{\n"
+      << "  \"source\": \"" << argv[1] << "\",\n"
+      << "  \"lines\": " << lines << ",\n"
+      << "  \"bytes\": " << bytes << ",\n"
+      << "  \"tokens\": " << tokens << ",\n"
+      << "  \"threads\": " << threads << ",\n"
+      << "  \"run\": \"" << (!plain.finished ? "unfinished" : plain.ok ? "ok" : "error") << "\",\n";
+    report("lex", lex, lines, bytes, false);
+    report("translate", translate, lines, bytes, false);
+    report("translate_parallel", parallel, lines, bytes, false);
+    report("link", link, lines, bytes, true);
+    std::cout << "}\n";
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include <random>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+//
+//  Generator of synthetic Rasm sources for assembler benchmark. Every
+//  eighth line defines label, other lines are random instructions of all
+//  kinds. Jumps and calls go forward to labels not defined yet with given
+//  percentage, so translator keeps many unresolved labels at once, others
+//  go back. Output assembles, it is not meant to be run, unless /run is
+//  given: then every jump goes forward, the last ones to label after the
+//  last line, there are no calls, loads are relative to sp as stores are,
+//  and stack starts above stack bottom, so program ends without error and
+//  never reads its own code or addresses in it
+//
+//    rasmGen <lines> <output> [forward percent] [seed] [/run]
+//
+
+static constexpr uint64_t labelEvery = 8;
+static constexpr uint64_t window = 64;
+
+//
+//  stack reserved above stack bottom by /run program before the first
+//  instruction, so pop doesn't get to the program
+//
+
+static constexpr uint64_t runStack = 4096;
+
+class RasmGenerator
+{
+public:
+
+  RasmGenerator(uint64_t lines, unsigned forward, uint64_t seed, bool runnable);
+
+  void write(std::ostream&);
+
+private:
+
+  void instruction_(std::ostream&, uint64_t);
+  const char* reg_();
+  uint64_t random_(uint64_t);
+
+  uint64_t lines_;
+  uint64_t labels_;
+  unsigned forward_;
+  bool runnable_;
+  std::mt19937_64 random_engine_;
+};
+
+RasmGenerator::RasmGenerator(uint64_t lines, unsigned forward, uint64_t seed, bool runnable) :
+  lines_(lines),
+  labels_((lines + labelEvery - 1) / labelEvery),
+  forward_(std::min(forward, 100u)),
+  runnable_(runnable),
+  random_engine_(seed)
+{
+}
+
+void RasmGenerator::write(std::ostream& out)
+{
+  if (runnable_) {
+    out << "    mov r0, " << runStack << "\n    add sp, r0\n    mov r0, 0\n";
+  }
+  for (uint64_t line = 0; line < lines_; line++) {
+    if (line % labelEvery == 0) {
+      out << "label_" << line / labelEvery << ":\n";
+    } else {
+      instruction_(out, line / labelEvery);
+    }
+  }
+  if (runnable_) {
+    out << "label_" << labels_ << ":\n";
+  }
+}
+
+void RasmGenerator::instruction_(std::ostream& out, uint64_t label)
+{
+  static const char* const binary[] = { "add", "sub", "and", "or", "xor", "not", "cmp" };
+
+  //
+  //  call is the last jump, /run program has no calls
+  //
+
+  static const char* const jumps[] = { "jmp", "jz", "jnz", "jg", "jl", "je", "jne", "call" };
+  static const char* const sizes[] = { "byte", "word", "dword", "qword" };
+
+  switch (random_(10)) {
+  case 0: [[fallthrough]];
+  case 1:
+    out << "    " << binary[random_(std::size(binary))] << " " << reg_() << ", " << reg_() << "\n";
+    break;
+  case 2:
+    out << "    mov " << reg_() << ", " << random_(1ull << 32) << "\n";
+    break;
+  case 3:
+    out << "    mov " << reg_() << ", " << reg_() << "\n";
+    break;
+  case 4:
+    out << "    mov " << reg_() << ", " << sizes[random_(4)] << " [" << (runnable_ ? "sp" : reg_()) << " + "
+      << random_(256) << "]\n";
+    break;
+  case 5:
+    out << "    mov " << sizes[random_(4)] << " [sp + " << random_(256) << "], " << reg_() << " ; store\n";
+    break;
+  case 6:
+    out << "    " << (random_(2) ? "push " : "pop ") << sizes[random_(4)] << " " << reg_() << "\n";
+    break;
+  default: {
+    uint64_t target;
+    if (runnable_) {
+      target = label + 1 + random_(std::min(window, labels_ - label));
+    } else if (label + 1 < labels_ && random_(100) < forward_) {
+      target = label + 1 + random_(std::min(window, labels_ - label - 1));
+    } else {
+      target = label - random_(std::min(window, label + 1));
+    }
+    out << "    " << jumps[random_(std::size(jumps) - runnable_)] << " label_" << target << "\n";
+  }
+  }
+}
+
+const char* RasmGenerator::reg_()
+{
+  static const char* const registers[] = { "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7" };
+  return registers[random_(std::size(registers))];
+}
+
+uint64_t RasmGenerator::random_(uint64_t bound)
+{
+  return std::uniform_int_distribution<uint64_t>{ 0, bound - 1 }(random_engine_);
+}
+
+int main(int argc, char* argv[])
+{
+  bool runnable = argc > 3 && strcmp(argv[argc - 1], "/run") == 0;
+  if (runnable) {
+    --argc;
+  }
+  if (argc < 3 || argc > 5) {
+    std::cerr << "usage: rasmGen <lines> <output> [forward percent] [seed] [/run]\n";
+    return 2;
+  }
+  try {
+    auto lines = std::stoull(argv[1]);
+    auto forward = argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : 80u;
+    auto seed = argc > 4 ? std::stoull(argv[4]) : 1ull;
+    std::ofstream out{ argv[2] };
+    if (!out.is_open()) {
+      throw std::ios_base::failure{ std::string{ "could not open " } + argv[2] };
+    }
+    RasmGenerator{ lines, forward, seed, runnable }.write(out);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,316 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "rasmTranslator.hpp"
+
+#include "rvm.hpp"
+
+//
+//  Interpreter benchmark: assembles every kernel from kernels directory
+//  with RasmTranslator in memory, counts its instructions in one profiled
+//  run, then times best of several plain runs. Kernel sources contain
+//  ITERATIONS placeholder, which is replaced with iteration count before
+//  assembling. Results are written to stdout as JSON
+//
+//    rvmBench <kernels directory> [/quick] [/repeat n] [/check]
+//
+//  /quick divides iteration counts by 1000 and runs once, for smoke test.
+//  /check times nothing: it assembles every kernel with /quick counts in
+//  every layout (plain, /O, /v2, /O /v2) and runs it by interpreter and
+//  JIT, small programs which end in error are run by both too. It fails if
+//  output, registers or status of any run differ from plain program run by
+//  interpreter; Ip is compared only in the same layout, it is code address
+//
+
+struct BenchPolicy : RvmNoexceptPolicy
+{
+  using io_t = MemoryIo;
+};
+
+struct BenchProfilePolicy : RvmProfilePolicy
+{
+  using io_t = MemoryIo;
+};
+
+struct kernel_t
+{
+  const char* name;
+  uint64_t iterations;
+};
+
+//
+//  iteration counts give about 100M executed instructions per kernel
+//
+
+static const kernel_t kernels[] = {
+  { "alu",       10000000 },
+  { "recursion", 400      },
+  { "memory",    8000000  },
+  { "pushpop",   10000000 },
+  { "branchy",   6000000  }
+};
+
+static constexpr uint64_t memorySize = 1 << 20;
+
+struct layout_t
+{
+  const char* name;
+  bool optimize;
+  bool compact;
+};
+
+static const layout_t layouts[] = {
+  { "",        false, false },
+  { " /O",     true,  false },
+  { " /v2",    false, true  },
+  { " /O /v2", true,  true  }
+};
+
+static std::vector<uint8_t> assemble(const std::filesystem::path& source, uint64_t iterations,
+  const layout_t& layout = layouts[0])
+{
+  std::ifstream in{ source };
+  if (!in.is_open()) {
+    throw std::ios_base::failure{ "could not open " + source.string() };
+  }
+  std::string text{ std::istreambuf_iterator<char>{ in }, {} };
+  static const std::string placeholder = "ITERATIONS";
+  for (auto pos = text.find(placeholder); pos != std::string::npos; pos = text.find(placeholder, pos)) {
+    text.replace(pos, placeholder.size(), std::to_string(iterations));
+  }
+
+  std::vector<uint8_t> program;
+  RasmTranslator translator;
+  translator.optimize(layout.optimize);
+  translator.compact(layout.compact);
+  auto status = translator.translate(std::string_view{ text }, program);
+  if (!status) {
+    std::cerr << source.string() << ": " << status;
+    throw std::runtime_error{ "could not assemble " + source.string() };
+  }
+  return program;
+}
+
+//
+//  executed instructions, SyncFlags pseudo instructions are not counted
+//
+
+static uint64_t countInstructions(const RvmCode& program)
+{
+  Rvm<BenchProfilePolicy> vm{ memorySize };
+  auto status = vm.run(program);
+  if (!status.ok) {
+    throw std::runtime_error{ status.message };
+  }
+  uint64_t count = 0;
+  for (uint64_t adr = 0; adr < program.size(); adr++) {
+    count += vm.profile().hits(adr);
+  }
+  return count;
+}
+
+static double timeRuns(const RvmCode& program, unsigned repeat)
+{
+  auto best = std::chrono::duration<double>::max();
+  for (unsigned i = 0; i < repeat; i++) {
+    Rvm<BenchPolicy> vm{ memorySize };
+    auto start = std::chrono::steady_clock::now();
+    auto status = vm.run(program);
+    auto time = std::chrono::steady_clock::now() - start;
+    if (!status.ok) {
+      throw std::runtime_error{ status.message };
+    }
+    best = std::min<std::chrono::duration<double>>(best, time);
+  }
+  return best.count();
+}
+
+//
+//  programs of /check which stop with error after some output: out of
+//  bounds load and store, return and jump to address which is not start
+//  of instruction, and trap of invalid opcode. Tail bytes are appended to
+//  assembled code: jmp 1 and invalid opcode
+//
+
+struct failing_t
+{
+  const char* name;
+  const char* source;
+  std::vector<uint8_t> tail;
+};
+
+static const failing_t failing[] = {
+  { "load_out_of_bounds",  "mov r0, 33\nmov ir, r0\nint 0\nmov r1, 2000000\nmov r2, qword [r1]\n",    {} },
+  { "store_out_of_bounds", "mov r0, 33\nmov ir, r0\nint 0\nmov r1, 1048572\nmov dword [r1 + 2], r0\n", {} },
+  { "invalid_return",      "mov r0, 33\nmov ir, r0\nint 0\nmov r0, 3\npush qword r0\nret\n",           {} },
+  { "invalid_jump",        "mov r0, 33\nmov ir, r0\nint 0\n",                    { 9, 0, 0, 0, 0, 0, 0, 0, 0, 1 } },
+  { "invalid_opcode",      "mov r0, 33\nmov ir, r0\nint 0\nmov r1, 7\nadd r1, r0\n",                   { 0xFF } }
+};
+
+//
+//  everything run leaves behind, Fg is compared as flags after the last
+//  instruction. Sp and Bp are kept relative to stack bottom, which is end
+//  of program, so they are the same in every layout
+//
+
+struct outcome_t
+{
+  bool ok;
+  std::string message;
+  std::string output;
+  uint64_t registers[RvmIsa::RegSize];
+};
+
+static outcome_t runOnce(const RvmCode& program, bool jit)
+{
+  Rvm<BenchPolicy> vm{ memorySize };
+  auto status = jit ? vm.runJit(program) : vm.run(program);
+  outcome_t outcome{ status.ok, status.message, vm.io().sink(), {} };
+  for (uint8_t r = 0; r < RvmIsa::RegSize; r++) {
+    outcome.registers[r] = vm.reg(r) - (r == RvmIsa::Sp || r == RvmIsa::Bp ? program.size() : 0);
+  }
+  return outcome;
+}
+
+static bool same(const std::string& name, const outcome_t& expected, const outcome_t& got, bool sameLayout)
+{
+  bool ok = true;
+  if (expected.ok != got.ok || expected.message != got.message) {
+    std::cerr << name << ": status \"" << expected.message << "\" differs from \"" << got.message << "\"\n";
+    ok = false;
+  }
+  if (expected.output != got.output) {
+    std::cerr << name << ": output differs\n";
+    ok = false;
+  }
+  for (uint8_t r = 0; r < RvmIsa::RegSize; r++) {
+    if (expected.registers[r] != got.registers[r] && (sameLayout || r != RvmIsa::Ip)) {
+      std::cerr << name << ": " << RvmIsa::registers[r] << " is " << got.registers[r]
+        << " instead of " << expected.registers[r] << "\n";
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+//
+//  optimized and compact programs must behave as plain one, JIT as
+//  interpreter, including errors and their messages
+//
+
+static int check(const std::filesystem::path& directory)
+{
+  bool ok = true;
+  size_t runs = 0;
+  for (const auto& kernel : kernels) {
+    auto source = directory / (std::string{ kernel.name } + ".asm");
+    auto iterations = std::max<uint64_t>(kernel.iterations / 1000, 1);
+    auto expected = runOnce(RvmCode{ assemble(source, iterations) }, false);
+    for (const auto& layout : layouts) {
+      RvmCode program{ assemble(source, iterations, layout) };
+      auto name = kernel.name + std::string{ layout.name };
+      bool sameLayout = &layout == layouts;
+      if (!sameLayout) {
+        ok = same(name, expected, runOnce(program, false), false) && ok;
+        ++runs;
+      }
+#ifdef RVM_JIT
+      ok = same(name + " jit", expected, runOnce(program, true), sameLayout) && ok;
+      ++runs;
+#endif
+    }
+  }
+
+#ifdef RVM_JIT
+  for (const auto& program : failing) {
+    std::vector<uint8_t> code;
+    RasmTranslator translator;
+    auto status = translator.translate(std::string_view{ program.source }, code);
+    if (!status) {
+      std::cerr << program.name << ": " << status;
+      throw std::runtime_error{ std::string{ "could not assemble " } + program.name };
+    }
+    code.insert(code.end(), program.tail.begin(), program.tail.end());
+    RvmCode bytes{ std::move(code) };
+    ok = same(std::string{ program.name } + " jit", runOnce(bytes, false), runOnce(bytes, true), true) && ok;
+    ++runs;
+  }
+#endif
+  if (!ok) {
+    return 1;
+  }
+  std::cout << runs << " runs alike\n";
+  return 0;
+}
+
+//
+//  peak resident set of the whole process so far, in KiB
+//
+
+static long peakRss()
+{
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    std::cerr << "usage: rvmBench <kernels directory> [/quick] [/repeat n] [/check]\n";
+    return 2;
+  }
+  bool quick = false;
+  bool checked = false;
+  unsigned repeat = 5;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "/quick") == 0) {
+      quick = true;
+    } else if (strcmp(argv[i], "/check") == 0) {
+      checked = true;
+    } else if (strcmp(argv[i], "/repeat") == 0 && i + 1 < argc) {
+      repeat = std::max(std::stoul(argv[++i]), 1ul);
+    } else {
+      std::cerr << "unknown option " << argv[i] << "\n";
+      return 2;
+    }
+  }
+  if (quick) {
+    repeat = 1;
+  }
+
+  try {
+    if (checked) {
+      return check(argv[1]);
+    }
+    std::cout << "{\n  \"kernels\": [";
+    for (size_t i = 0; i < std::size(kernels); i++) {
+      auto iterations = quick ? std::max<uint64_t>(kernels[i].iterations / 1000, 1) : kernels[i].iterations;
+      RvmCode program{ assemble(std::filesystem::path{ argv[1] } / (std::string{ kernels[i].name } + ".asm"), iterations) };
+      auto instructions = countInstructions(program);
+      auto seconds = timeRuns(program, repeat);
+
+      std::cout << (i ? "," : "") << "\n    {"
+        << " \"name\": \"" << kernels[i].name << "\","
+        << " \"iterations\": " << iterations << ","
+        << " \"instructions\": " << instructions << ","
+        << " \"seconds\": " << seconds << ","
+        << " \"ips\": " << instructions / seconds << ","
+        << " \"ns_per_insn\": " << seconds * 1e9 / instructions << ","
+        << " \"peak_rss_kb\": " << peakRss() << " }";
+    }
+    std::cout << "\n  ],\n  \"peak_rss_kb\": " << peakRss() << "\n}\n";
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -1,32 +1,240 @@
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <thread>
+#include <filesystem>
 
 #include "utilities.hpp"
 #include "rasmTranslator.hpp"
+#include "rasmCache.hpp"
 
-#define RVM_NOEXCEPT
 #include "rvm.hpp"
+#include "rvmPool.hpp"
+#include "rvmDisassembler.hpp"
 
 int main(int argc, char* argv[])
 {
+  bool optimize = false;
+  bool compact = false;
+  unsigned threads = 1;
+  while (argc > 1) {
+    if (strcmp(argv[1], "/O") == 0) {
+      optimize = true;
+    } else if (strcmp(argv[1], "/v2") == 0) {
+      compact = true;
+    } else if (strcmp(argv[1], "/P") == 0) {
+      threads = std::max(std::thread::hardware_concurrency(), 1u);
+    } else {
+      break;
+    }
+    --argc;
+    ++argv;
+  }
   try {
+    if (argc >= 4 && strcmp(argv[1], "/l") == 0) {
+
+      //
+      //  sources are translated through cache, object files are linked as is
+      //
+
+      RasmCache cache{ RasmCache::defaultDirectory() };
+      std::vector<RasmObject> objects(argc - 3);
+      bool ok = true;
+      for (int i = 3; i < argc; i++) {
+        auto& object = objects[i - 3];
+        std::ifstream in{ argv[i], std::ifstream::in | std::ifstream::binary };
+        if (object.read(in)) {
+          object.name = argv[i];
+          continue;
+        }
+        auto s = cache.load(argv[i], object);
+        if (!s) {
+          std::cout << argv[i] << ": " << s;
+          ok = false;
+        }
+      }
+      if (!ok) {
+        return 1;
+      }
+      RasmTranslator translator;
+      translator.optimize(optimize);
+      translator.compact(compact);
+      translator.threads(threads);
+      std::vector<uint8_t> program;
+      auto s = translator.link(objects, program);
+      if (s) {
+        std::ofstream dst{ argv[2], std::ofstream::out | std::ofstream::binary };
+        if (!dst.is_open()) {
+          throw std::ios_base::failure{ std::string{ "could not open " } + argv[2] };
+        }
+        dst.write(reinterpret_cast<const char*>(program.data()), static_cast<std::streamsize>(program.size()));
+      }
+      std::cout << s;
+      std::cout << "Cache: " << cache.hits() << " hits, " << cache.misses() << " misses\n";
+      if (s && (optimize || compact)) {
+        const auto& stats = translator.optimizationStats();
+        std::cout << "Optimized: " << stats.instructions << " instructions, " << stats.bytes << " bytes saved, "
+          << stats.jumps << " jumps threaded\n";
+      }
+      return s ? 0 : 1;
+    }
     switch (argc) {
-    case 3: if (strcmp(argv[1], "/e") == 0) {
-      auto program = readBCode(argv[2]);
-      Rvm vm{};
+    case 3: if (strcmp(argv[1], "/e") == 0 || strcmp(argv[1], "/j") == 0) {
+      RvmCode program{ argv[2] };
+      Rvm<RvmNoexceptPolicy> vm{};
+      auto s = strcmp(argv[1], "/j") == 0 ? vm.runJit(program) : vm.run(program);
+      if (!s.ok) {
+        std::cerr << s.message << "\n";
+        return 1;
+      }
+      break;
+    } else if (strcmp(argv[1], "/profile") == 0) {
+      RvmCode program{ argv[2] };
+      Rvm<RvmProfilePolicy> vm{};
       auto s = vm.run(program);
+      vm.io().flush();
+      vm.profile().dump(std::cerr);
       if (!s.ok) {
         std::cerr << s.message << "\n";
         return 1;
       }
       break;
+    } else if (strcmp(argv[1], "/batch") == 0) {
+      RvmPool<> pool;
+      std::map<std::string, RvmPool<>::program_t> programs;
+      auto jobs = readManifest(argv[2]);
+      for (const auto& [path, input] : jobs) {
+        auto& program = programs[path];
+        if (!program) {
+          program = std::make_shared<const RvmCode>(path);
+        }
+        auto bytes = input.empty() ? std::vector<uint8_t>{} : readBCode(input);
+        pool.add(program, std::string{ bytes.begin(), bytes.end() });
+      }
+      auto results = pool.run();
+      int failed = 0;
+      for (size_t i = 0; i < results.size(); i++) {
+        std::cout << results[i].output;
+        if (!results[i].ok) {
+          std::cerr << jobs[i].first << ": " << results[i].message << "\n";
+          ++failed;
+        }
+      }
+      if (failed) {
+        return 1;
+      }
+      break;
     }
-    case 4: if (strcmp(argv[1], "/a") == 0) {
+    case 4: [[fallthrough]];
+    case 5: if (strcmp(argv[1], "/c") == 0 && argc == 4) {
+      std::ifstream src{ argv[2] };
+      RasmObject object;
+      RasmTranslator translator;
+      auto s = translator.translate(src, object);
+      if (s) {
+        std::ofstream dst{ argv[3], std::ofstream::out | std::ofstream::binary };
+        if (!dst.is_open()) {
+          throw std::ios_base::failure{ std::string{ "could not open " } + argv[3] };
+        }
+        object.write(dst);
+      }
+      std::cout << s;
+      break;
+    } else if (strcmp(argv[1], "/a") == 0) {
       std::ifstream src{ argv[2],  };
       std::ofstream dst{ argv[3], std::ofstream::out | std::ofstream::binary };
       RasmTranslator translator;
+      translator.optimize(optimize);
+      translator.compact(compact);
+      translator.threads(threads);
       auto s = translator.translate(src, dst);
+      if (s && argc == 5) {
+        std::ofstream symbols{ argv[4] };
+        translator.writeSymbols(symbols);
+      }
       std::cout << s;
+      if (s && (optimize || compact)) {
+        const auto& stats = translator.optimizationStats();
+        std::cout << "Optimized: " << stats.instructions << " instructions, " << stats.bytes << " bytes saved, "
+          << stats.jumps << " jumps threaded\n";
+      }
+      break;
+    } else if (strcmp(argv[1], "/d") == 0 && argc <= 4) {
+      auto program = readBCode(argv[2]);
+      std::ofstream listing;
+      if (argc == 4) {
+        listing.open(argv[3]);
+        if (!listing.is_open()) {
+          throw std::ios_base::failure{ std::string{ "could not open " } + argv[3] };
+        }
+      }
+      RvmDisassembler disassembler;
+      if (!disassembler.disassemble(program, argc == 4 ? listing : std::cout)) {
+        std::cerr << "program is malformed, see listing\n";
+        return 1;
+      }
+      break;
+    } else if (strcmp(argv[1], "/record") == 0 && argc == 4) {
+      std::ofstream trace{ argv[3], std::ofstream::out | std::ofstream::binary };
+      if (!trace.is_open()) {
+        throw std::ios_base::failure{ std::string{ "could not open " } + argv[3] };
+      }
+      RvmCode program{ argv[2] };
+      Rvm<RvmRecordPolicy> vm{};
+      vm.recorder().open(trace);
+      auto s = vm.run(program);
+      if (!s.ok) {
+        std::cerr << s.message << "\n";
+        return 1;
+      }
+      break;
+    } else if (strcmp(argv[1], "/replay") == 0 && argc >= 4) {
+      std::ifstream trace{ argv[3], std::ifstream::in | std::ifstream::binary };
+      if (!trace.is_open()) {
+        throw std::ios_base::failure{ std::string{ "could not open " } + argv[3] };
+      }
+      RvmCode program{ argv[2] };
+      Rvm<RvmReplayPolicy> vm{};
+      vm.replayer().open(trace);
+      if (argc == 5) {
+        vm.replayer().stopAt(std::stoull(argv[4]));
+      }
+      auto s = vm.run(program);
+      vm.io().flush();
+      if (!s.ok) {
+        std::cerr << s.message << "\n";
+        return 1;
+      }
+      if (!vm.finished()) {
+        std::cerr << "stopped at checkpoint " << argv[4] << ":";
+        for (auto reg : vm.replayer().registers()) {
+          std::cerr << " " << reg;
+        }
+        std::cerr << "\n";
+      }
+      break;
+    } else if (strcmp(argv[1], "/sample") == 0 && argc >= 4) {
+      std::ofstream out{ argv[3] };
+      if (!out.is_open()) {
+        throw std::ios_base::failure{ std::string{ "could not open " } + argv[3] };
+      }
+      RvmSymbols symbols;
+      if (argc == 5) {
+        std::ifstream map{ argv[4] };
+        if (!map.is_open()) {
+          throw std::ios_base::failure{ std::string{ "could not open " } + argv[4] };
+        }
+        symbols = RvmSymbols{ map };
+      }
+      RvmCode program{ argv[2] };
+      Rvm<RvmSamplePolicy> vm{};
+      auto s = vm.run(program);
+      vm.io().flush();
+      vm.sampler().dump(out, symbols);
+      if (!s.ok) {
+        std::cerr << s.message << "\n";
+        return 1;
+      }
       break;
     }
     default:
@@ -2,21 +2,16 @@
 
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 std::vector<uint8_t> readBCode(const std::string& file)
 {
-  size_t length;
-  std::fstream t{ file, std::ios::binary | std::ios::in | std::ios::ate };
-  if (t) {
-    length = t.tellg();
-    t.close();
-  } else {
-    throw std::ios_base::failure{ "could not open " + file };
-  }
-  std::ifstream fin{ file, std::ios::in | std::ios::binary };
+  std::ifstream fin{ file, std::ios::in | std::ios::binary | std::ios::ate };
   if (!fin.is_open()) {
     throw std::ios_base::failure{ "could not open " + file };
   }
+  auto length = static_cast<size_t>(fin.tellg());
+  fin.seekg(0);
   std::vector<uint8_t> bCode(length);
   fin.read(reinterpret_cast<char*>(bCode.data()), length);
   if (!fin.eof() && fin.fail()) {
@@ -25,8 +20,48 @@ std::vector<uint8_t> readBCode(const std::string& file)
   return bCode;
 }
 
+//
+//  manifest for /batch: one job per line, "program_path [input_path]",
+//  empty lines and lines starting with # are skipped
+//
+
+std::vector<std::pair<std::string, std::string>> readManifest(const std::string& file)
+{
+  std::ifstream fin{ file };
+  if (!fin.is_open()) {
+    throw std::ios_base::failure{ "could not open " + file };
+  }
+  std::vector<std::pair<std::string, std::string>> jobs;
+  std::string line;
+  while (std::getline(fin, line)) {
+    std::istringstream fields{ line };
+    std::string program, input;
+    if (!(fields >> program) || program[0] == '#') {
+      continue;
+    }
+    fields >> input;
+    jobs.emplace_back(program, input);
+  }
+  return jobs;
+}
+
 void manual()
 {
   std::cout << "/e %file_path%    -    execute file_path\n"
-            << "/a %src% %dst%    -    assembly src to dst\n";
+            << "/j %file_path%    -    execute file_path with jit compiler\n"
+            << "/profile %file%   -    execute file, print execution counters to stderr\n"
+            << "/sample %file% %out% [%sym%] - execute file, write sampled call stacks to out\n"
+            << "/record %file% %trace% - execute file, record execution trace\n"
+            << "/replay %file% %trace% [%checkpoint%] - replay trace, stop at checkpoint\n"
+            << "/a %src% %dst% [%sym%] - assembly src to dst, write label addresses to sym\n"
+            << "/O /a %src% %dst% [%sym%] - assembly with peephole optimization\n"
+            << "/v2 /a %src% %dst% [%sym%] - assembly to compact format version 2, may follow /O\n"
+            << "/P /a %src% %dst% [%sym%] - assembly on all cores, combines with /O, /v2 and /l\n"
+            << "/c %src% %obj%   -    assembly src to object file obj for /l\n"
+            << "/d %file% [%dst%] -   disassembly file to dst or stdout\n"
+            << "/l %dst% %src|obj% ... - link sources and object files to dst, /O and /v2 may precede,\n"
+            << "                         sources are assembled once per text, through cache of user:\n"
+            << "                         $XDG_CACHE_HOME/rasm or ~/.cache/rasm (%LOCALAPPDATA%\\rasm on Windows),\n"
+            << "                         directory with mode 0700, not used if owned by other user or writable by others\n"
+            << "/batch %manifest% -    execute every program listed in manifest\n";
 }
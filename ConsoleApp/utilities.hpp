@@ -1,6 +1,8 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <utility>
 
 std::vector<uint8_t> readBCode(const std::string&);
+std::vector<std::pair<std::string, std::string>> readManifest(const std::string&);
 void manual();
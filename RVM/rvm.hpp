@@ -4,30 +4,122 @@
 #include <array>
 #include <vector>
 #include <string>
+#include <memory>
+#include <iterator>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 
+#include "rvmIsa.hpp"
+#include "rvmJit.hpp"
+#include "rvmMemory.hpp"
+#include "rvmPolicy.hpp"
+#include "rvmProfile.hpp"
+#include "rvmSampler.hpp"
+#include "rvmRecord.hpp"
+
+#ifdef _MSC_VER
 #pragma warning( push             )
 #pragma warning( disable : C26451 )
 #pragma warning( disable : C26812 )
 #pragma warning( disable : C4083  )
 #pragma warning( disable : C4244  )
 #pragma warning( disable : C4334  )
+#define RVM_FORCEINLINE __forceinline
+#else
+#define RVM_FORCEINLINE inline __attribute__((always_inline))
+#endif
 
-#ifdef RVM_NOEXCEPT
-#define EXPECT_REG_EXISTS(reg_n) if ((reg_n) >= RegSize) {\
-  return { false, "invalid register at " + std::to_string(registers_[Ip]) };\
+#define RAISE_ERROR(message) {\
+  if constexpr (Policy::exceptions) {\
+    throw std::runtime_error{ (message) };\
+  } else {\
+    return { false, (message) };\
+  }\
 }
-#else
-#define EXPECT_REG_EXISTS(reg_n) if ((reg_n) >= RegSize) {\
-  throw std::runtime_error{ "invalid register at " + std::to_string(registers_[Ip]) };\
+
+#define JUMP_TO(pc, adr) if (((pc) = entry_(adr)) == NoEntry) {\
+  RAISE_ERROR("invalid jump destination " + std::to_string(adr))\
+}
+
+#define EXPECT_MEMORY(adr, bytes) if (Policy::checked && !memory_.contains((adr), (bytes))) {\
+  RAISE_ERROR("memory access out of bounds at " + std::to_string(registers_[Ip]))\
+}
+
+#define EXPECT_PROGRAM_FITS(program) if ((program).size() > memory_.size() || (program).size() >= NoEntry) {\
+  RAISE_ERROR("program does not fit in memory")\
 }
+
+//
+//  end of basic block: every jump is recorded to or checked against trace
+//  and spends one unit of step budget. When budget is spent or replay
+//  stops, loop leaves through pause and keeps pc for resume
+//
+
+#define CHARGE if ((Policy::recorded || Policy::replayed) && !trace_block_(pc)) {\
+  goto trace_stop;\
+}\
+if (Budgeted && --budget == 0) {\
+  goto pause;\
+}
+
+#define PROFILE_BRANCH(taken) if constexpr (Policy::profiled) {\
+  profile_.branch(addresses_[insn - code_.data()], (taken));\
+}
+
+#define FOLLOW_IP_WRITE if (insn->writesIp) {\
+  JUMP_TO(pc, registers_[Ip])\
+  CHARGE\
+}
+
+//
+//  RVM_THREADED_DISPATCH: every handler ends with its own indirect jump
+//  through table of label addresses (GCC/Clang labels as values). Otherwise
+//  (or with RVM_SWITCH_DISPATCH defined) portable switch is used
+//
+
+#if defined(__GNUC__) && !defined(RVM_SWITCH_DISPATCH)
+#define RVM_THREADED_DISPATCH
+#endif
+
+#define FETCH insn = &code_[pc++];\
+  if constexpr (Policy::traced) {\
+    if (insn->handler != SyncFlagsHandler) {\
+      Policy::trace(addresses_[insn - code_.data()], insn->op, registers_.data());\
+    }\
+  }\
+  if constexpr (Policy::profiled) {\
+    if (insn->handler < SyncFlagsHandler) {\
+      profile_.instruction(addresses_[insn - code_.data()], insn->op);\
+      if (insn->op == Mov) {\
+        profile_.mov(insn->mode, insn->size);\
+      }\
+    }\
+  }\
+  if constexpr (Policy::sampled) {\
+    if (insn->handler != SyncFlagsHandler) {\
+      sampler_.tick();\
+    }\
+  }\
+  registers_[Ip] = insn->next;
+
+#ifdef RVM_THREADED_DISPATCH
+#define DISPATCH_BEGIN FETCH goto *handlers[insn->handler];
+#define DISPATCH_END
+#define HANDLER(name) name##Handler:
+#define DISPATCH FETCH goto *handlers[insn->handler];
+#else
+#define DISPATCH_BEGIN for (;;) { FETCH switch (insn->handler) {
+#define DISPATCH_END ABORT_IF_DEFAULT } }
+#define HANDLER(name) case name##Handler:
+#define DISPATCH continue;
 #endif
 
 #define ABORT_IF_DEFAULT default: assert(false);
 
 #if __cplusplus >= 201703L
-#define FALLTHROUGH [[fallthrough]]
+#define FALLTHROUGH [[fallthrough]];
 #define NODISCARD [[nodiscard]]
 #else
 #define FALLTHROUGH
@@ -46,7 +138,19 @@ constexpr bool logicXor(bool a, bool b)
 }
 
 
-class Rvm
+//
+//  Policy decides error model, checks, tracing and I/O of the machine,
+//  see rvmPolicy.hpp. Disabled features cost nothing at run time.
+//  Opcodes, registers and formats are those of RvmIsa, see rvmIsa.hpp.
+//
+//  Code is decoded once, when program is loaded (see decode_), both
+//  interpreter and JIT run decoded instructions. Code bytes stay in memory
+//  and may be read and written, but written bytes are not executed:
+//  self-modifying program runs its code as it was loaded
+//
+
+template <class Policy = RvmPolicy>
+class Rvm : RvmIsa
 {
 public:
 
@@ -59,65 +163,127 @@ public:
   explicit Rvm(uint64_t = 10000);
 
 
-#ifdef RVM_NOEXCEPT
-  NODISCARD status_t run(const std::vector<uint8_t>&) noexcept;
-#else
-  void run(const std::vector<uint8_t>&);
-#endif
+  //
+  //  program is given either as bytes, which are copied to memory, or as
+  //  RvmCode, which is mapped to memory without copying (see rvmMemory.hpp)
+  //
 
-private:
+  NODISCARD status_t run(const std::vector<uint8_t>&) noexcept(!Policy::exceptions);
+  NODISCARD status_t run(const RvmCode&) noexcept(!Policy::exceptions);
 
-  enum OpCodes
-  {
-    Add,
-    Sub,
+  //
+  //  resumable execution: load prepares program without running it, step
+  //  runs until program ends or budget is spent, resume runs to the end.
+  //  Budget is charged only by jumps, calls, returns and Ip writes, so
+  //  step executes at most budget basic blocks. Machine is paused after
+  //  step if it returned ok and finished() is false
+  //
 
-    And,
-    Or,
-    Xor,
-    Not,
+  NODISCARD status_t load(const std::vector<uint8_t>&) noexcept(!Policy::exceptions);
+  NODISCARD status_t load(const RvmCode&) noexcept(!Policy::exceptions);
+  NODISCARD status_t step(uint64_t) noexcept(!Policy::exceptions);
+  NODISCARD status_t resume() noexcept(!Policy::exceptions);
+  bool finished() const noexcept;
 
-    Mov,
-    Push,
-    Pop,
+  //
+  //  new machine in the same state: registers, memory, decoded program,
+  //  halted and paused state. Memory of both machines becomes private
+  //  copy of one frozen image, pages are copied only when written. Forks
+  //  taken without running in between share the same image. I/O device
+  //  of child is new. Throws std::bad_alloc if memory can't be mapped
+  //
 
-    Jmp,
-    Call,
-    Ret,
-    Int,
+  std::unique_ptr<Rvm> fork();
 
-    Cmp,
-    Test
-  };
+  //
+  //  same as run, but each basic block is translated to x86-64 code
+  //  before its first execution. Memory is always range checked, trace,
+  //  profile and sampler hooks are not called from generated code, so
+  //  such policies run interpreter instead
+  //
 
-  enum Registers
-  {
-    R0,
-    R1,
-    R2,
-    R3,
-    R4,
-    R5,
-    R6,
-    R7,
-
-    Ir,
-    Fg,
-    Ip,
-    Sp,
-    Bp,
-
-    RegSize
-  };
+  NODISCARD status_t runJit(const std::vector<uint8_t>&) noexcept(!Policy::exceptions);
+  NODISCARD status_t runJit(const RvmCode&) noexcept(!Policy::exceptions);
+
+  void dumpFusionStats(std::ostream&) const;
+
+  //
+  //  value of register, Fg is brought up to date with the last result
+  //
+
+  uint64_t reg(uint8_t) const noexcept;
+
+  typename Policy::io_t& io() noexcept;
+  const RvmProfile& profile() const noexcept;
+  RvmSampler& sampler() noexcept;
+  RvmRecorder& recorder() noexcept;
+  RvmReplayer& replayer() noexcept;
+
+private:
+
+  static constexpr bool Hooked = Policy::traced || Policy::profiled || Policy::sampled
+    || Policy::recorded || Policy::replayed;
+
+  //
+  //  decoded instruction handlers, one per opcode, Mov mode and Jmp mode
+  //
 
-  enum MemSize
+  enum Handlers
   {
-    Byte,
-    Word,
-    Dword,
-    Qword
+    AddHandler,
+    SubHandler,
+    AndHandler,
+    OrHandler,
+    XorHandler,
+    NotHandler,
+
+    MovImmHandler,
+    MovRegHandler,
+    MovLoadHandler,
+    MovStoreHandler,
+    PushHandler,
+    PopHandler,
+
+    JmpHandler,
+    JmpNegHandler,
+    JmpZeroHandler,
+    JmpPosHandler,
+    CallHandler,
+    RetHandler,
+    IntHandler,
+
+    CmpHandler,
+    TestHandler,
+
+    //
+    //  stores pending flags to Fg, put by decode_ before every instruction
+    //  with Fg operand
+    //
+
+    SyncFlagsHandler,
+
+    //
+    //  superinstructions, made by fuse_ from two adjacent instructions
+    //
+
+    MovImmStoreHandler,
+    SubJccHandler,
+    CmpJccHandler,
+
+    TrapHandler,
+    EndHandler,
+
+    HandlerSize
   };
 
+  //
+  //  handler of every opcode, for Mov and Jmp handler of mode 0
+  //
+
+#define RVM_OPCODE_HANDLER(name, mnemonic, format, handler) handler##Handler,
+  static constexpr Handlers opcode_handlers_[] = { RVM_INSTRUCTIONS(RVM_OPCODE_HANDLER) };
+#undef RVM_OPCODE_HANDLER
+
   enum Interrupt
   {
     PutC,
@@ -134,438 +300,1120 @@ private:
     PosFlag = 1 << 2
   };
 
+  //
+  //  instruction after decode_: operands unpacked, immediate assembled,
+  //  jump destination resolved to index in code_
+  //
+
+  struct instruction_t
+  {
+    uint8_t handler;
+    uint8_t op;
+    uint8_t dst;
+    uint8_t src;
+    uint8_t mode;
+    uint8_t size;
+    bool neg;
+    bool writesIp;
+    uint32_t target;
+    uint32_t next;
+    uint64_t imm;
+  };
+
+  static constexpr uint32_t NoEntry = ~0u;
+
+  enum JitExit
+  {
+    JitContinue,
+    JitInterrupt,
+    JitTrap,
+    JitFault
+  };
+
+  Rvm(const Rvm&, const RvmImage&);
+
+  template <bool Budgeted>
+  status_t execute_(uint64_t) noexcept(!Policy::exceptions);
+
   void push_(uint64_t, MemSize);
   uint64_t pop_(MemSize);
 
   void run_interrupt_(Interrupt);
+  bool trace_block_(uint32_t);
   void update_flags_(uint64_t);
-
-  uint64_t get_num_(MemSize, uint64_t);
-  void load_num_(MemSize, uint64_t, uint64_t);
-  uint64_t extend_byte_logical_(uint64_t);
+  uint64_t flags_();
+  static uint64_t flags_of_(uint64_t);
+
+
+  template <class Program>
+  status_t start_(const Program&) noexcept(!Policy::exceptions);
+  status_t run_jit_() noexcept(!Policy::exceptions);
+
+  void load_(const std::vector<uint8_t>&);
+  void load_(const RvmCode&);
+  void reset_(uint64_t);
+  void decode_(uint64_t);
+  void fuse_();
+  void add_trap_(instruction_t&, const std::string&);
+  uint32_t entry_(uint64_t) const;
+
+  static Handlers base_handler_(uint8_t);
+  static bool sets_flags_(Handlers);
+  static bool ends_block_(const instruction_t&);
+#ifdef RVM_JIT
+  uint8_t* compile_block_(uint32_t);
+#endif
 
 
   std::array<uint64_t, RegSize> registers_{};
-  std::vector<uint8_t> stack_{};
+  RvmMemory memory_;
+  std::shared_ptr<const RvmImage> image_{};
   uint64_t stack_bottom_ = 0;
   bool halted_ = false;
+  uint32_t pc_ = 0;
+  bool finished_ = true;
+
+  //
+  //  Fg is computed lazily: instructions only record their result, Fg is
+  //  brought up to date by flags_ when conditional jump or Fg operand needs it
+  //
+
+  uint64_t last_result_ = 0;
+  bool flags_pending_ = false;
+
+  typename Policy::io_t io_{};
+  RvmProfile profile_{};
+  RvmSampler sampler_{};
+  RvmRecorder recorder_{};
+  RvmReplayer replayer_{};
+
+  std::vector<instruction_t> code_{};
+  std::vector<uint32_t> addresses_{};
+  std::vector<uint32_t> entries_{};
+  std::vector<std::string> traps_{};
+  std::array<size_t, TrapHandler - MovImmStoreHandler> fused_{};
+
+#ifdef RVM_JIT
+  std::unique_ptr<X64Emitter> jit_{};
+  std::vector<uint8_t*> blocks_{};
+#endif
 };
 
 
-__forceinline Rvm::Rvm(uint64_t stackSize) :
-  stack_(stackSize)
+template <class Policy>
+RVM_FORCEINLINE Rvm<Policy>::Rvm(uint64_t stackSize) :
+  memory_(stackSize)
 {
   std::fill(registers_.begin(), registers_.end(), 0);
 }
 
-#ifdef RVM_NOEXCEPT
-NODISCARD Rvm::status_t Rvm::run(const std::vector<uint8_t>& program) noexcept
-#else
-void Rvm::run(const std::vector<uint8_t>& program)
-#endif
+template <class Policy>
+Rvm<Policy>::Rvm(const Rvm& parent, const RvmImage& image) :
+  registers_(parent.registers_),
+  memory_(image),
+  stack_bottom_(parent.stack_bottom_),
+  halted_(parent.halted_),
+  pc_(parent.pc_),
+  finished_(parent.finished_),
+  last_result_(parent.last_result_),
+  flags_pending_(parent.flags_pending_),
+  code_(parent.code_),
+  addresses_(parent.addresses_),
+  entries_(parent.entries_),
+  traps_(parent.traps_),
+  fused_(parent.fused_)
 {
-  std::copy(program.begin(), program.end(), stack_.begin());
-  stack_bottom_ = program.size();
-  registers_[Sp] = stack_bottom_;
-  registers_[Bp] = stack_bottom_;
-  registers_[Ip] = 0;
-  while (registers_[Ip] < stack_bottom_ && !halted_) {
-    auto opCode = stack_[registers_[Ip]++];
-    switch (opCode) {
-
-      //
-      //  Add: 8 bit opcode + 4 bit dest reg + 4 bit src reg
-      //
-      //  for simplicity we cant do something like "add r0, [r1 + 20],
-      //  but this con be accomplished with mov, then add
-      //
-
-    case Add : FALLTHROUGH
-
-      //
-      //  Sub. Similar to add format
-      //
-
-    case Sub : FALLTHROUGH
-
-      //
-      //  Bitwise And. Simple as it is. Format similar to add
-      //
-
-    case And : FALLTHROUGH
-
-      //
-      //  Bitwise Or
-      //
-
-    case Or : FALLTHROUGH
-
-      //
-      //  Bitwise Xor
-      //
-
-    case Xor : FALLTHROUGH
-
-      //
-      //  Bitwise Not
-      //
-
-    case Not : {
-
-      uint8_t dst = stack_[registers_[Ip]] >> 4 & 0xF;
-      uint8_t src = stack_[registers_[Ip]] & 0xF;
-      EXPECT_REG_EXISTS(dst)
-      EXPECT_REG_EXISTS(src)
-      switch (opCode) {
-      case Add :
-        registers_[dst] += registers_[src];
-        break;
-      case Sub :
-        registers_[dst] += (~registers_[src] + 1);
-        break;
-      case And :
-        registers_[dst] &= registers_[src];
-        break;
-      case Or :
-        registers_[dst] |= registers_[src];
-        break;
-      case Xor :
-        registers_[dst] ^= registers_[src];
-        break;
-      case Not :
-        registers_[dst] = ~registers_[src];
-        break;
-      ABORT_IF_DEFAULT
-      }
-      update_flags_(registers_[dst]);
-      ++registers_[Ip];
-      break;
+}
+
+template <class Policy>
+std::unique_ptr<Rvm<Policy>> Rvm<Policy>::fork()
+{
+  if (!image_) {
+    image_ = memory_.freeze();
+  }
+  return std::unique_ptr<Rvm>(new Rvm(*this, *image_));
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::run(const std::vector<uint8_t>& program) noexcept(!Policy::exceptions)
+{
+  auto status = start_(program);
+  return status.ok ? execute_<false>(0) : status;
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::run(const RvmCode& program) noexcept(!Policy::exceptions)
+{
+  auto status = start_(program);
+  return status.ok ? execute_<false>(0) : status;
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::load(const std::vector<uint8_t>& program) noexcept(!Policy::exceptions)
+{
+  auto status = start_(program);
+  finished_ = !status.ok;
+  return status;
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::load(const RvmCode& program) noexcept(!Policy::exceptions)
+{
+  auto status = start_(program);
+  finished_ = !status.ok;
+  return status;
+}
+
+template <class Policy>
+template <class Program>
+typename Rvm<Policy>::status_t Rvm<Policy>::start_(const Program& program) noexcept(!Policy::exceptions)
+{
+  EXPECT_PROGRAM_FITS(program)
+  load_(program);
+  pc_ = halted_ ? entry_(stack_bottom_) : 0;
+  return { true, {} };
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::step(uint64_t budget) noexcept(!Policy::exceptions)
+{
+  if (finished_ || budget == 0) {
+    return { true, {} };
+  }
+  return execute_<true>(budget);
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::resume() noexcept(!Policy::exceptions)
+{
+  if (finished_) {
+    return { true, {} };
+  }
+  return execute_<false>(0);
+}
+
+template <class Policy>
+bool Rvm<Policy>::finished() const noexcept
+{
+  return finished_;
+}
+
+//
+//  interpreter loop, starts at code_[pc_]. Machine counts as finished
+//  unless loop stops because budget is spent, so errors end it too
+//
+
+template <class Policy>
+template <bool Budgeted>
+typename Rvm<Policy>::status_t Rvm<Policy>::execute_(uint64_t budget) noexcept(!Policy::exceptions)
+{
+  auto pc = pc_;
+  finished_ = true;
+  image_.reset();
+  const instruction_t* insn;
+
+#ifdef RVM_THREADED_DISPATCH
+  static const void* const handlers[] = {
+    &&AddHandler,     &&SubHandler,      &&AndHandler,     &&OrHandler,
+    &&XorHandler,     &&NotHandler,      &&MovImmHandler,  &&MovRegHandler,
+    &&MovLoadHandler, &&MovStoreHandler, &&PushHandler,    &&PopHandler,
+    &&JmpHandler,     &&JmpNegHandler,   &&JmpZeroHandler, &&JmpPosHandler,
+    &&CallHandler,    &&RetHandler,      &&IntHandler,     &&CmpHandler,
+    &&TestHandler,    &&SyncFlagsHandler, &&MovImmStoreHandler, &&SubJccHandler,
+    &&CmpJccHandler,  &&TrapHandler,     &&EndHandler
+  };
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) == HandlerSize);
+#endif
+
+  DISPATCH_BEGIN
+
+  HANDLER(Add)
+    registers_[insn->dst] += registers_[insn->src];
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(Sub)
+    registers_[insn->dst] += (~registers_[insn->src] + 1);
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(And)
+    registers_[insn->dst] &= registers_[insn->src];
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(Or)
+    registers_[insn->dst] |= registers_[insn->src];
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(Xor)
+    registers_[insn->dst] ^= registers_[insn->src];
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(Not)
+    registers_[insn->dst] = ~registers_[insn->src];
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(MovImm)
+    registers_[insn->dst] = insn->imm;
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(MovReg)
+    registers_[insn->dst] = registers_[insn->src];
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(MovLoad) {
+    auto adr = registers_[insn->src] + insn->imm;
+    EXPECT_MEMORY(adr, 1_ull << insn->size)
+    registers_[insn->dst] = memory_.read(insn->size, adr);
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+  }
+
+  HANDLER(MovStore) {
+    auto adr = registers_[insn->dst] + insn->imm;
+    EXPECT_MEMORY(adr, 1_ull << insn->size)
+    auto num = registers_[insn->src];
+    memory_.write(insn->size, adr, num);
+    update_flags_(num & ~0_ull >> (64 - (8_ull << insn->size)));
+    DISPATCH
+  }
+
+  HANDLER(Push)
+    EXPECT_MEMORY(registers_[Sp], 1_ull << insn->size)
+    push_(registers_[insn->src], MemSize(insn->size));
+    DISPATCH
+
+  HANDLER(Pop)
+    EXPECT_MEMORY(registers_[Sp] - (1_ull << insn->size), 1_ull << insn->size)
+    registers_[insn->dst] = pop_(MemSize(insn->size));
+    update_flags_(registers_[insn->dst]);
+    FOLLOW_IP_WRITE
+    DISPATCH
+
+  HANDLER(Jmp)
+    pc = insn->target;
+    CHARGE
+    DISPATCH
+
+  HANDLER(JmpNeg) {
+    bool taken = logicXor(flags_() & NegFlag, insn->neg);
+    PROFILE_BRANCH(taken)
+    pc = taken ? insn->target : pc;
+    CHARGE
+    DISPATCH
+  }
+
+  HANDLER(JmpZero) {
+    bool taken = logicXor(flags_() & ZeroFlag, insn->neg);
+    PROFILE_BRANCH(taken)
+    pc = taken ? insn->target : pc;
+    CHARGE
+    DISPATCH
+  }
+
+  HANDLER(JmpPos) {
+    bool taken = logicXor(flags_() & PosFlag, insn->neg);
+    PROFILE_BRANCH(taken)
+    pc = taken ? insn->target : pc;
+    CHARGE
+    DISPATCH
+  }
+
+  HANDLER(Call)
+    EXPECT_MEMORY(registers_[Sp], 8)
+    push_(registers_[Ip], Qword);
+    if constexpr (Policy::sampled) {
+      sampler_.call(insn->imm);
+    }
+    pc = insn->target;
+    CHARGE
+    DISPATCH
+
+  HANDLER(Ret) {
+    EXPECT_MEMORY(registers_[Sp] - 8, 8)
+    registers_[Ip] = pop_(Qword);
+    if constexpr (Policy::sampled) {
+      sampler_.ret();
     }
+    JUMP_TO(pc, registers_[Ip])
+    CHARGE
+    DISPATCH
+  }
 
-      //
-      //  MOVE (COPY)
-      //
-      //  format: 8 bit opcode | mod + size? + dstReg + | srcReg / num
-      //
-      //  mode:
-      //
-      //  00 reg <- num            : opcode | 00 + 00 + (???? - dstReg) | num ... 
-      //  01 reg <- reg            : opcode | 01 + 00 + (???? - dstReg) | (???? - srcReg) + 0000
-      //  10 reg <- [reg + offset] : opcode | 10 + (?? - movSize) + (???? - dstReg) | (???? - srcReg) +  0000 | num ...
-      //  11 [reg + offset] <- reg : opcode | 11 + (?? - movSize) + (???? - dstReg) | (???? - srcReg) + 0000 | num ...
-      //
-      //  examples:
-      //
-      //  MOV R0, qword [BP + 10]  ==  00000110 | 10'11'0000 | 1011'00'00 | 00001010
-      //  MOV word [BP - 512], R3  ==  00000110 | 11'01'1011 | 0011'01'00 | 11111101 | 11111111
-      //
-
-    case Mov : {
-      auto fstByte = stack_[registers_[Ip]++];
-      auto mode = fstByte >> 6 & 0x3, dstReg = fstByte & 0xF;
-      EXPECT_REG_EXISTS(dstReg);
-      switch (mode) {
-      case 0b00 : {
-        registers_[dstReg] = get_num_(Qword, registers_[Ip]);
-        registers_[Ip] += 1_ull << 3;
-        update_flags_(registers_[dstReg]);
-        break;
-      }
-      case 0b01 : {
-        auto srcReg = stack_[registers_[Ip]++] >> 4 & 0xF;
-        EXPECT_REG_EXISTS(srcReg);
-        registers_[dstReg] = registers_[srcReg];
-        update_flags_(registers_[dstReg]);
-        break;
-      }
-      case 0b10 : {
-        auto movSize = fstByte >> 4 & 0x3;
-        auto srcReg = stack_[registers_[Ip]] >> 4 & 0xF;
-        EXPECT_REG_EXISTS(srcReg);
-        auto offset = get_num_(Qword, registers_[Ip]);
-        registers_[Ip] += 1_ull << 3;
-        registers_[dstReg] = get_num_(MemSize(movSize), stack_[registers_[srcReg] + offset]);
-        update_flags_(registers_[dstReg]);
-        break;
-      }
-      case 0b11 : {
-        auto movSize = fstByte >> 4 & 0x3;
-        auto srcReg = stack_[registers_[Ip]++] >> 4 & 0xF;
-        EXPECT_REG_EXISTS(srcReg);
-        auto offset = get_num_(Qword, registers_[Ip]);
-        registers_[Ip] += 1_ull << 3;
-        load_num_(MemSize(movSize), registers_[dstReg] + offset, registers_[srcReg]);
-        update_flags_(get_num_(MemSize(movSize), registers_[dstReg] + offset));
-        break;
-      }
-      ABORT_IF_DEFAULT
-      }
-      break;
+  HANDLER(Int)
+    if constexpr (Policy::profiled) {
+      profile_.interrupt(insn->imm);
     }
+    run_interrupt_(Interrupt(insn->imm));
+    if (halted_) {
+      goto finish;
+    }
+    DISPATCH
+
+  HANDLER(Cmp)
+    update_flags_(registers_[insn->dst] + (~registers_[insn->src] + 1));
+    DISPATCH
+
+  HANDLER(Test)
+    update_flags_(registers_[insn->src]);
+    DISPATCH
+
+  HANDLER(SyncFlags)
+    flags_();
+    DISPATCH
+
+  //
+  //  insn + 1 is the second fused instruction. It stays in code_ unchanged,
+  //  so jumps into the middle of the pattern still run it alone
+  //
+
+  HANDLER(MovImmStore) {
+    const auto* store = insn + 1;
+    registers_[insn->dst] = insn->imm;
+    registers_[Ip] = store->next;
+    auto adr = registers_[store->dst] + store->imm;
+    EXPECT_MEMORY(adr, 1_ull << store->size)
+    auto num = registers_[store->src];
+    memory_.write(store->size, adr, num);
+    update_flags_(num & ~0_ull >> (64 - (8_ull << store->size)));
+    ++pc;
+    DISPATCH
+  }
 
-      //
-      //  push value of some size from reg to stack
-      //
-      //  format: opcode | (????) - srcReg, (??) - size, 00 
-      //
-
-    case Push : {
-      auto srcReg = stack_[registers_[Ip]] >> 4 & 0xF;
-      EXPECT_REG_EXISTS(srcReg);
-      auto size = stack_[registers_[Ip]++] >> 2 & 0x3;
-      push_(registers_[srcReg], MemSize(size));
-      break;
+  HANDLER(SubJcc) {
+    const auto* jmp = insn + 1;
+    registers_[insn->dst] += (~registers_[insn->src] + 1);
+    update_flags_(registers_[insn->dst]);
+    pc = logicXor(flags_of_(last_result_) & 1 << (jmp->mode - 1), jmp->neg) ? jmp->target : pc + 1;
+    CHARGE
+    DISPATCH
+  }
+
+  HANDLER(CmpJcc) {
+    const auto* jmp = insn + 1;
+    update_flags_(registers_[insn->dst] + (~registers_[insn->src] + 1));
+    pc = logicXor(flags_of_(last_result_) & 1 << (jmp->mode - 1), jmp->neg) ? jmp->target : pc + 1;
+    CHARGE
+    DISPATCH
+  }
+
+  HANDLER(Trap)
+    RAISE_ERROR(traps_[insn->imm])
+
+  HANDLER(End)
+    goto finish;
+
+  DISPATCH_END
+
+finish:
+  io_.flush();
+  if constexpr (Policy::recorded) {
+    recorder_.finish();
+  }
+  if constexpr (Policy::replayed) {
+    if (!replayer_.finish()) {
+      RAISE_ERROR(replayer_.error())
     }
+  }
+  return { true, {} };
 
-      //
-      //  pop value of some size to register
-      //
-      //  format: opcode | (????) - srcReg, (??) - size, 00
-      //
-
-    case Pop : {
-      auto dstReg = stack_[registers_[Ip]] >> 4 & 0xF;
-      EXPECT_REG_EXISTS(dstReg);
-      auto size = stack_[registers_[Ip]++] >> 2 & 0x3;
-      registers_[dstReg] = pop_(MemSize(size));
-      update_flags_(registers_[dstReg]);
+trace_stop:
+  if (replayer_.failed()) {
+    RAISE_ERROR(replayer_.error())
+  }
+
+pause:
+  pc_ = pc;
+  finished_ = false;
+  return { true, {} };
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::runJit(const std::vector<uint8_t>& program) noexcept(!Policy::exceptions)
+{
+  auto status = start_(program);
+  return status.ok ? run_jit_() : status;
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::runJit(const RvmCode& program) noexcept(!Policy::exceptions)
+{
+  auto status = start_(program);
+  return status.ok ? run_jit_() : status;
+}
+
+template <class Policy>
+typename Rvm<Policy>::status_t Rvm<Policy>::run_jit_() noexcept(!Policy::exceptions)
+{
+#ifndef RVM_JIT
+  RAISE_ERROR("jit is not supported on this platform")
+#else
+  if constexpr (Hooked) {
+    return execute_<false>(0);
+  }
+  flags_();
+  try {
+    if (jit_) {
+      jit_->reset();
+    } else {
+      jit_ = std::make_unique<X64Emitter>();
+    }
+  } catch (const std::exception& e) {
+    RAISE_ERROR(e.what())
+  }
+  blocks_.assign(code_.size(), nullptr);
+  const auto end = entry_(stack_bottom_);
+  while (!halted_) {
+    auto adr = registers_[Ip];
+    auto pc = entry_(adr);
+    if (pc == NoEntry) {
+      RAISE_ERROR("invalid jump destination " + std::to_string(adr))
+    }
+    if (pc == end) {
       break;
     }
+    auto block = blocks_[pc] ? blocks_[pc] : compile_block_(pc);
+    auto code = jit_->enter(block, registers_.data(), memory_.data(), memory_.size());
+    switch (code & 0xFF) {
+    case JitContinue :
+      break;
+    case JitInterrupt :
+      run_interrupt_(Interrupt(code >> 8));
+      break;
+    case JitTrap :
+      RAISE_ERROR(traps_[code >> 8])
+    case JitFault :
+      RAISE_ERROR("memory access out of bounds at " + std::to_string(registers_[Ip]))
+    ABORT_IF_DEFAULT
+    }
+  }
+  io_.flush();
+  return { true, {} };
+#endif
+}
+
+template <class Policy>
+void Rvm<Policy>::load_(const std::vector<uint8_t>& program)
+{
+  std::copy(program.begin(), program.end(), memory_.data());
+  reset_(program.size());
+}
+
+template <class Policy>
+void Rvm<Policy>::load_(const RvmCode& program)
+{
+  memory_.attach(program);
+  reset_(program.size());
+}
+
+template <class Policy>
+void Rvm<Policy>::reset_(uint64_t codeSize)
+{
+  image_.reset();
+  if constexpr (Policy::profiled) {
+    profile_.reset(codeSize);
+  }
+  if constexpr (Policy::sampled) {
+    sampler_.reset();
+  }
+  stack_bottom_ = codeSize;
+  registers_[Sp] = stack_bottom_;
+  registers_[Bp] = stack_bottom_;
+  decode_(stack_bottom_);
+  registers_[Ip] = addresses_.front();
+}
 
-      //
-      //  jump somewhere
-      //
-      //  format: opcode | (?) - negBit, (??) - mode, 00000 | 64 bit dest
-      //
-      //  modes: 00 - if true
-      //         01 - if neg
-      //         10 - if zero
-      //         11 - if pos
-      //
-      //  example: opcode | 10100000 | ... - jump if not neg (jnn)
-      //
-      //  comment: jump if not true doesn't really exist, so combination of neg bit with 00 mode equivalent to 000
-      //
-
-    case Jmp : {
-      bool neg = stack_[registers_[Ip]] >> 7 & 0x1;
-      auto mode = stack_[registers_[Ip]++] >> 5 & 0x3;
-      auto dest = get_num_(Qword, registers_[Ip]);
-      registers_[Ip] += 8;
-
-      switch (mode) {
-      case 0b00 :
-        registers_[Ip] = dest;
-        break;
-      case 0b01 :
-        registers_[Ip] = logicXor(registers_[Fg] & NegFlag, neg) ? dest : registers_[Ip];
-        break;
-      case 0b10 :
-        registers_[Ip] = logicXor(registers_[Fg] & ZeroFlag, neg) ? dest : registers_[Ip];
-        break;
-      case 0b11 :
-        registers_[Ip] = logicXor(registers_[Fg] & PosFlag, neg) ? dest : registers_[Ip];
-        break;
-      ABORT_IF_DEFAULT
+//
+//  translates program from memory_[0, programSize) into code_, one instruction_t
+//  per bytecode instruction, and fills entries_, which maps bytecode address
+//  to index in code_. code_ is terminated with EndHandler, end of code and any
+//  address >= programSize lead to it. Malformed instructions are not reported at once, but decoded
+//  to TrapHandler, so error arises only if such instruction is executed.
+//
+//  Program starting with CompactHeader is in format version 2, code follows
+//  the header. Bits 5-4 of opcode byte are then width of immediate, offset
+//  or jump destination: 1, 2, 4 or 8 bytes, as MemSize. Immediates and
+//  offsets are zero extended, jump and call destinations are sign extended
+//  displacements from address of next instruction. Other fields are the
+//  same as in version 1, described at RvmIsa::decode.
+//
+//  Program starting with SectionedHeader is in format version 3, with data:
+//
+//    FF 'R' 'V' 03 | encoding | 3 reserved bytes | code size | data size
+//
+//  sizes are 32 bit, encoding is format version of code, 1 or 2. Code
+//  follows the header, data follows code. Whole program is loaded to
+//  memory, so data is at its address right away and stack starts after
+//  it. Only code is decoded, jump to data is invalid destination
+//
+
+template <class Policy>
+void Rvm<Policy>::decode_(uint64_t programSize)
+{
+  code_.clear();
+  addresses_.clear();
+  traps_.clear();
+  entries_.assign(programSize + 1, NoEntry);
+  auto starts = [&](const uint8_t (&header)[4]) {
+    return programSize >= sizeof(header) && std::equal(std::begin(header), std::end(header), memory_.data());
+  };
+  bool compact = false;
+  uint64_t adr = 0;
+  uint64_t codeSize = programSize;
+  if (starts(CompactHeader)) {
+    compact = true;
+    adr = sizeof(CompactHeader);
+  } else if (starts(SectionedHeader) && programSize >= SectionedHeaderSize) {
+    compact = memory_.read(Byte, 4) == 2;
+    adr = SectionedHeaderSize;
+    codeSize = std::min(programSize, adr + memory_.read(Dword, 8));
+  }
+  auto fetch = [&](MemSize size) -> uint64_t {
+    auto bytes = 1_ull << size;
+    if (adr > codeSize || bytes > codeSize - adr) {
+      adr = codeSize + 1;
+      return 0;
+    }
+    auto num = memory_.read(size, adr);
+    adr += bytes;
+    return num;
+  };
+  MemSize width = Qword;
+  auto fetchTarget = [&]() -> uint64_t {
+    if (!compact) {
+      return fetch(Qword);
+    }
+    auto shift = 64 - (8_ull << width);
+    auto displacement = static_cast<int64_t>(fetch(width) << shift) >> shift;
+    return adr + displacement;
+  };
+  while (adr < codeSize) {
+    entries_[adr] = static_cast<uint32_t>(code_.size());
+    addresses_.push_back(static_cast<uint32_t>(adr));
+    instruction_t insn{};
+    insn.op = static_cast<uint8_t>(fetch(Byte));
+    if (compact) {
+      width = MemSize(insn.op >> 4 & 0x3);
+      insn.op &= 0xCF;
+    }
+    fields_t fields{ insn.op };
+    auto byte = [&] { return fetch(Byte); };
+    auto number = [&](bool target) { return target ? fetchTarget() : fetch(width); };
+    if (decode(fields, byte, number)) {
+      insn.dst = fields.dst;
+      insn.src = fields.src;
+      insn.mode = fields.mode;
+      insn.size = fields.size;
+      insn.neg = fields.neg;
+      insn.imm = fields.imm;
+      insn.handler = opcode_handlers_[insn.op] + insn.mode;
+      insn.writesIp = insn.dst == Ip && (insn.op <= Not || insn.op == Pop || (insn.op == Mov && insn.mode != 0b11));
+      if (Policy::checked && (insn.dst >= RegSize || insn.src >= RegSize)) {
+        add_trap_(insn, "invalid register at " + std::to_string(adr));
+      } else if (insn.op == Int && insn.imm >= IntSize) {
+        add_trap_(insn, "invalid interrupt id at " + std::to_string(adr));
       }
-      break;
+    } else {
+      add_trap_(insn, "invalid opcode at " + std::to_string(adr));
+      adr = codeSize;
+    }
+    if (adr > codeSize) {
+      add_trap_(insn, "unexpected end of program at " + std::to_string(codeSize));
+      adr = codeSize;
     }
+    insn.next = static_cast<uint32_t>(adr);
+    if (insn.handler != TrapHandler && (insn.dst == Fg || insn.src == Fg)) {
+      instruction_t sync{ SyncFlagsHandler };
+      sync.next = addresses_.back();
+      code_.push_back(sync);
+      addresses_.push_back(addresses_.back());
+    }
+    code_.push_back(insn);
+  }
+  entries_[codeSize] = entries_[programSize] = static_cast<uint32_t>(code_.size());
+  instruction_t end{ EndHandler };
+  end.next = static_cast<uint32_t>(codeSize);
+  code_.push_back(end);
+  addresses_.push_back(static_cast<uint32_t>(codeSize));
+  for (size_t i = 0; i < entries_[codeSize]; i++) {
+    auto& insn = code_[i];
+    if (insn.handler >= JmpHandler && insn.handler <= CallHandler) {
+      insn.target = entry_(insn.imm);
+      if (insn.target == NoEntry) {
+        instruction_t trap{};
+        add_trap_(trap, "invalid jump destination " + std::to_string(insn.imm) + " at " + std::to_string(insn.next));
+        trap.next = insn.next;
+        insn.target = static_cast<uint32_t>(code_.size());
+        code_.push_back(trap);
+        addresses_.push_back(static_cast<uint32_t>(insn.imm));
+      }
+    }
+  }
+#ifndef RVM_NO_SUPERINSTRUCTIONS
+  if constexpr (!Policy::traced && !Policy::profiled) {
+    fuse_();
+  }
+#endif
+}
 
-      //
-      //  push IP and jump
-      //
-      //  format: opcode | 64 bit of dest ip
-      //
-
-    case Call : {
-      auto dst = get_num_(Qword, registers_[Ip]);
-      registers_[Ip] += 8;
-      push_(registers_[Ip], Qword);
-      registers_[Ip] = dst;
-      break;
+//
+//  replaces first instruction of each frequent pair with superinstruction:
+//
+//  mov reg, num      + mov size [reg + offset], reg  ->  MovImmStore
+//  sub reg, reg      + conditional jmp               ->  SubJcc
+//  cmp reg, reg      + conditional jmp               ->  CmpJcc
+//
+//  pair is never fused if its first instruction writes Ip
+//
+
+template <class Policy>
+void Rvm<Policy>::fuse_()
+{
+  fused_.fill(0);
+  for (size_t i = 0; i + 1 < code_.size(); i++) {
+    auto& fst = code_[i];
+    const auto& snd = code_[i + 1];
+    if (fst.writesIp) {
+      continue;
+    }
+    bool condJmp = snd.handler >= JmpNegHandler && snd.handler <= JmpPosHandler;
+    if (fst.handler == MovImmHandler && snd.handler == MovStoreHandler) {
+      fst.handler = MovImmStoreHandler;
+    } else if (fst.handler == SubHandler && condJmp) {
+      fst.handler = SubJccHandler;
+    } else if (fst.handler == CmpHandler && condJmp) {
+      fst.handler = CmpJccHandler;
+    } else {
+      continue;
     }
+    ++fused_[fst.handler - MovImmStoreHandler];
+    ++i;
+  }
+}
+
+template <class Policy>
+uint64_t Rvm<Policy>::reg(uint8_t r) const noexcept
+{
+  return r == Fg && flags_pending_ ? flags_of_(last_result_) : registers_[r];
+}
 
-      //
-      //  pop IP and jump
-      //
-      //  format: opcode
-      //
+template <class Policy>
+typename Policy::io_t& Rvm<Policy>::io() noexcept
+{
+  return io_;
+}
 
-    case Ret : {
-      auto dst = pop_(Qword);
-      registers_[Ip] = dst;
-      break;
+template <class Policy>
+const RvmProfile& Rvm<Policy>::profile() const noexcept
+{
+  return profile_;
+}
+
+template <class Policy>
+RvmSampler& Rvm<Policy>::sampler() noexcept
+{
+  return sampler_;
+}
+
+template <class Policy>
+RvmRecorder& Rvm<Policy>::recorder() noexcept
+{
+  return recorder_;
+}
+
+template <class Policy>
+RvmReplayer& Rvm<Policy>::replayer() noexcept
+{
+  return replayer_;
+}
+
+template <class Policy>
+void Rvm<Policy>::dumpFusionStats(std::ostream& out) const
+{
+  static const char* const names[] = { "mov imm + mov store", "sub + jcc", "cmp + jcc" };
+  size_t total = 0;
+  for (size_t i = 0; i < fused_.size(); i++) {
+    out << names[i] << ": " << fused_[i] << "\n";
+    total += fused_[i];
+  }
+  out << "fused pairs: " << total << "\n";
+}
+
+template <class Policy>
+RVM_FORCEINLINE void Rvm<Policy>::add_trap_(instruction_t& insn, const std::string& message)
+{
+  insn.handler = TrapHandler;
+  insn.imm = traps_.size();
+  traps_.push_back(message);
+}
+
+template <class Policy>
+RVM_FORCEINLINE uint32_t Rvm<Policy>::entry_(uint64_t adr) const
+{
+  return adr < stack_bottom_ ? entries_[adr] : entries_[stack_bottom_];
+}
+
+template <class Policy>
+typename Rvm<Policy>::Handlers Rvm<Policy>::base_handler_(uint8_t handler)
+{
+  switch (handler) {
+  case MovImmStoreHandler :
+    return MovImmHandler;
+  case SubJccHandler :
+    return SubHandler;
+  case CmpJccHandler :
+    return CmpHandler;
+  default :
+    return Handlers(handler);
+  }
+}
+
+template <class Policy>
+bool Rvm<Policy>::sets_flags_(Handlers handler)
+{
+  return handler <= MovStoreHandler || handler == PopHandler || handler == CmpHandler || handler == TestHandler;
+}
+
+template <class Policy>
+bool Rvm<Policy>::ends_block_(const instruction_t& insn)
+{
+  return insn.writesIp || (insn.handler >= JmpHandler && insn.handler <= IntHandler)
+    || insn.handler == TrapHandler || insn.handler == EndHandler;
+}
+
+#ifdef RVM_JIT
+
+//
+//  translates basic block starting at code_[first] to x86-64 code. Superinstructions
+//  are compiled as their parts. Registers live in registers_ (pinned in rbx),
+//  flags are stored to Fg only if some later instruction of the block can see them.
+//  Jumps to already compiled blocks are linked directly, jumps to traps of invalid
+//  destination raise them, other exits store next address to Ip and return to
+//  runJit. Int, Ret and writes to Ip always return
+//
+
+template <class Policy>
+uint8_t* Rvm<Policy>::compile_block_(uint32_t first)
+{
+  using Host = X64Emitter;
+  constexpr uint32_t maxBlock = 64;
+  constexpr size_t maxInstructionCode = 160;
+  if (jit_->room() < maxBlock * maxInstructionCode) {
+    jit_->reset();
+    std::fill(blocks_.begin(), blocks_.end(), nullptr);
+  }
+  auto last = first;
+  while (last - first + 1 < maxBlock && !ends_block_(code_[last])) {
+    ++last;
+  }
+  std::array<bool, maxBlock> liveFlags{};
+  bool live = true;
+  for (auto i = last + 1; i-- > first;) {
+    const auto& insn = code_[i];
+    auto handler = base_handler_(insn.handler);
+    liveFlags[i - first] = live;
+    bool reads = (handler >= JmpNegHandler && handler <= JmpPosHandler) || insn.dst == Fg || insn.src == Fg;
+    live = reads || (live && !sets_flags_(handler));
+  }
+
+  auto& e = *jit_;
+  std::vector<std::pair<uint8_t*, uint32_t>> faults;
+  auto transfer = [&](uint32_t pc, uint64_t adr) {
+    if (code_[pc].handler == TrapHandler) {
+      e.storeImm(Ip, code_[pc].next);
+      e.exit(JitTrap | static_cast<uint32_t>(code_[pc].imm) << 8);
+    } else if (blocks_[pc]) {
+      e.jmp(blocks_[pc]);
+    } else {
+      e.storeImm(Ip, adr);
+      e.exit(JitContinue);
+    }
+  };
+  auto address = [&](const instruction_t& insn) {
+    if (insn.imm != 0) {
+      e.movImm(Host::Rdx, insn.imm);
+      e.add(Host::Rax, Host::Rdx);
     }
+  };
 
-      //
-      //  run interrupt using Interrupt Register (Ir)
-      //
-      //  format: opcode | int_num
-      //
-
-    case Int : {
-      auto intNum = stack_[registers_[Ip]++];
-      if (intNum >= IntSize) {
-#ifdef RVM_NOEXCEPT
-        return { false, "invalid interrupt id at " + std::to_string(registers_[Ip]) };
-#else
-        throw std::runtime_error{"invalid interrupt id at " + std::to_string(registers_[Ip])};
-#endif
+  e.unlock();
+  auto block = blocks_[first] = e.here();
+  for (auto i = first; i <= last; i++) {
+    const auto& insn = code_[i];
+    auto handler = base_handler_(insn.handler);
+    auto flags = liveFlags[i - first];
+    auto bytes = uint8_t(1 << insn.size);
+    if (handler < TrapHandler && (insn.dst == Ip || insn.src == Ip)) {
+      e.storeImm(Ip, insn.next);
+    }
+    switch (handler) {
+    case AddHandler : FALLTHROUGH
+    case SubHandler : FALLTHROUGH
+    case AndHandler : FALLTHROUGH
+    case OrHandler  : FALLTHROUGH
+    case XorHandler : FALLTHROUGH
+    case CmpHandler :
+      e.load(Host::Rax, insn.dst);
+      e.load(Host::Rcx, insn.src);
+      switch (handler) {
+      case AddHandler : e.add(Host::Rax, Host::Rcx); break;
+      case AndHandler : e.bitAnd(Host::Rax, Host::Rcx); break;
+      case OrHandler  : e.bitOr(Host::Rax, Host::Rcx); break;
+      case XorHandler : e.bitXor(Host::Rax, Host::Rcx); break;
+      default : e.sub(Host::Rax, Host::Rcx);
+      }
+      if (handler != CmpHandler) {
+        e.store(insn.dst, Host::Rax);
       }
-      run_interrupt_(Interrupt(intNum));
       break;
-    }
-
-      //
-      //  sub SndReg from FstReg, update flags, discard result
-      //
-      //  format: opcode | (????) - FstReg, (????) - SndReg
-      //
-      //  cmp (5), (5) -> zFlag -> je, jge, jle - true
-      //
-      //  cmp (5), (4) -> pFlag -> jg, jge, jne - true
-      //
-
-    case Cmp : {
-      auto fstReg = stack_[registers_[Ip]] >> 4 & 0xF;
-      EXPECT_REG_EXISTS(fstReg)
-      auto sndReg = stack_[registers_[Ip]++] & 0xF;
-      EXPECT_REG_EXISTS(sndReg)
-      update_flags_(registers_[fstReg] += ~registers_[sndReg]);
+    case NotHandler :
+      e.load(Host::Rax, insn.src);
+      e.bitNot(Host::Rax);
+      e.store(insn.dst, Host::Rax);
+      break;
+    case MovImmHandler :
+      e.movImm(Host::Rax, insn.imm);
+      e.store(insn.dst, Host::Rax);
+      break;
+    case MovRegHandler :
+      e.load(Host::Rax, insn.src);
+      e.store(insn.dst, Host::Rax);
+      break;
+    case MovLoadHandler :
+      e.load(Host::Rax, insn.src);
+      address(insn);
+      faults.emplace_back(e.checkRange(bytes), insn.next);
+      e.loadMem(insn.size);
+      e.store(insn.dst, Host::Rax);
+      break;
+    case MovStoreHandler :
+      e.load(Host::Rax, insn.dst);
+      address(insn);
+      faults.emplace_back(e.checkRange(bytes), insn.next);
+      e.load(Host::Rcx, insn.src);
+      e.storeMem(insn.size);
+      if (flags) {
+        e.load(Host::Rax, insn.src);
+        e.zeroExtend(insn.size);
+      }
+      break;
+    case PushHandler :
+      e.load(Host::Rcx, insn.src);
+      e.load(Host::Rax, Sp);
+      faults.emplace_back(e.checkRange(bytes), insn.next);
+      e.storeMem(insn.size);
+      e.addRegImm(Sp, bytes);
+      break;
+    case PopHandler :
+      e.subRegImm(Sp, bytes);
+      e.load(Host::Rax, Sp);
+      faults.emplace_back(e.checkRange(bytes), insn.next);
+      e.loadMem(insn.size);
+      e.store(insn.dst, Host::Rax);
+      break;
+    case TestHandler :
+      e.load(Host::Rax, insn.src);
+      break;
+    case JmpHandler :
+      transfer(insn.target, insn.imm);
+      break;
+    case JmpNegHandler : FALLTHROUGH
+    case JmpZeroHandler : FALLTHROUGH
+    case JmpPosHandler : {
+      e.testRegImm(Fg, uint8_t(1 << (insn.mode - 1)));
+      auto taken = e.jcc(insn.neg ? Host::Zero : Host::NotZero);
+      transfer(i + 1, insn.next);
+      Host::patch(taken, e.here());
+      transfer(insn.target, insn.imm);
       break;
     }
-
-      //
-      //  update flags based on srcReg
-      //
-      //  format: opcode | (????) - srcReg 0000
-      //
-
-    case Test : {
-      auto srcReg = stack_[registers_[Ip]++] >> 4 & 0xF;
-      EXPECT_REG_EXISTS(srcReg);
-      update_flags_(registers_[srcReg]);
+    case CallHandler :
+      e.movImm(Host::Rcx, insn.next);
+      e.load(Host::Rax, Sp);
+      faults.emplace_back(e.checkRange(8), insn.next);
+      e.storeMem(Qword);
+      e.addRegImm(Sp, 8);
+      transfer(insn.target, insn.imm);
+      break;
+    case RetHandler :
+      e.subRegImm(Sp, 8);
+      e.load(Host::Rax, Sp);
+      faults.emplace_back(e.checkRange(8), insn.next);
+      e.loadMem(Qword);
+      e.store(Ip, Host::Rax);
+      e.exit(JitContinue);
+      break;
+    case IntHandler :
+      e.storeImm(Ip, insn.next);
+      e.exit(JitInterrupt | static_cast<uint32_t>(insn.imm) << 8);
+      break;
+    case TrapHandler :
+      e.storeImm(Ip, insn.next);
+      e.exit(JitTrap | static_cast<uint32_t>(insn.imm) << 8);
+      break;
+    case EndHandler :
+      e.storeImm(Ip, insn.next);
+      e.exit(JitContinue);
       break;
+    case SyncFlagsHandler :
+      break;
+    ABORT_IF_DEFAULT
     }
-
-    default :
-#ifdef RVM_NOEXCEPT
-      return { false, "invalid opcode at " + std::to_string(registers_[Ip]) };
-#else
-      throw std::runtime_error{"invalid opcode at " + std::to_string(registers_[Ip])};
-#endif
+    if (flags && sets_flags_(handler)) {
+      e.flags(Fg);
+    }
+    if (insn.writesIp) {
+      e.exit(JitContinue);
     }
   }
-#ifdef RVM_NOEXCEPT
-  return { true, {} };
-#endif
+  if (!ends_block_(code_[last])) {
+    transfer(last + 1, code_[last].next);
+  }
+  for (auto [at, next] : faults) {
+    Host::patch(at, e.here());
+    e.storeImm(Ip, next);
+    e.exit(JitFault);
+  }
+  e.lock();
+  return block;
 }
 
-__forceinline void Rvm::push_(uint64_t x, MemSize size)
+#endif // RVM_JIT
+
+template <class Policy>
+RVM_FORCEINLINE void Rvm<Policy>::push_(uint64_t x, MemSize size)
 {
-  load_num_(size, registers_[Sp], x);
+  memory_.write(size, registers_[Sp], x);
   registers_[Sp] += 1_ull << size;
 }
 
-__forceinline uint64_t Rvm::pop_(MemSize size)
+template <class Policy>
+RVM_FORCEINLINE uint64_t Rvm<Policy>::pop_(MemSize size)
 {
   registers_[Sp] -= 1_ull << size;
-  return get_num_(size, registers_[Sp]);
+  return memory_.read(size, registers_[Sp]);
 }
 
-__forceinline void Rvm::update_flags_(uint64_t x)
+template <class Policy>
+RVM_FORCEINLINE void Rvm<Policy>::update_flags_(uint64_t x)
 {
-  if (x == 0) {
-    registers_[Fg] = ZeroFlag;
-  } else if (x >> 63) {
-    registers_[Fg] = NegFlag;
-  } else {
-    registers_[Fg] = PosFlag;
-  }
-}
-
-uint64_t Rvm::get_num_(MemSize size, uint64_t adr)
-{
-  uint64_t res = 0;
-  switch (size) {
-  case Qword :
-    res |= extend_byte_logical_(stack_[adr++]) << 56;
-    res |= extend_byte_logical_(stack_[adr++]) << 48;
-    res |= extend_byte_logical_(stack_[adr++]) << 40;
-    res |= extend_byte_logical_(stack_[adr++]) << 32;
-    FALLTHROUGH
-  case Dword :
-    res |= extend_byte_logical_(stack_[adr++]) << 24;
-    res |= extend_byte_logical_(stack_[adr++]) << 16;
-    FALLTHROUGH
-  case Word :
-    res |= extend_byte_logical_(stack_[adr++]) << 8;
-    FALLTHROUGH
-  case Byte :
-    res |= extend_byte_logical_(stack_[adr++]);
-    break;
-  ABORT_IF_DEFAULT
+  last_result_ = x;
+  flags_pending_ = true;
+}
+
+template <class Policy>
+RVM_FORCEINLINE uint64_t Rvm<Policy>::flags_()
+{
+  if (flags_pending_) {
+    registers_[Fg] = flags_of_(last_result_);
+    flags_pending_ = false;
   }
-  return res;
-}
-
-void Rvm::load_num_(MemSize size, uint64_t adr, uint64_t num)
-{
-  switch (size) {
-  case Qword :
-    stack_[adr++] = num >> 56 & 0xFF;
-    stack_[adr++] = num >> 48 & 0xFF;
-    stack_[adr++] = num >> 40 & 0xFF;
-    stack_[adr++] = num >> 32 & 0xFF;
-    FALLTHROUGH
-  case Dword :
-    stack_[adr++] = num >> 24 & 0xFF;
-    stack_[adr++] = num >> 16 & 0xFF;
-    FALLTHROUGH
-  case Word :
-    stack_[adr++] = num >> 8 & 0xFF;
-    FALLTHROUGH
-  case Byte :
-    stack_[adr++] = num & 0xFF;
-    break;
-  ABORT_IF_DEFAULT
+  return registers_[Fg];
+}
+
+template <class Policy>
+RVM_FORCEINLINE uint64_t Rvm<Policy>::flags_of_(uint64_t x)
+{
+  if (x == 0) {
+    return ZeroFlag;
   }
+  return x >> 63 ? NegFlag : PosFlag;
 }
 
-__forceinline uint64_t Rvm::extend_byte_logical_(uint64_t x)
+//
+//  records block entry, or checks it against trace in replay. Returns false
+//  if loop has to stop: replay failed or reached stop checkpoint. Registers
+//  of checkpoint are taken with up to date Fg
+//
+
+template <class Policy>
+bool Rvm<Policy>::trace_block_(uint32_t pc)
 {
-  uint64_t res = 0;
-  res |= x;
-  return res;
+  if constexpr (Policy::recorded) {
+    if (recorder_.block(addresses_[pc])) {
+      flags_();
+      recorder_.checkpoint(registers_.data(), RegSize);
+    }
+  }
+  if constexpr (Policy::replayed) {
+    if (replayer_.block(addresses_[pc])) {
+      flags_();
+      return replayer_.checkpoint(registers_.data(), RegSize);
+    }
+    return !replayer_.failed();
+  }
+  return true;
 }
 
-void Rvm::run_interrupt_(Interrupt interrupt)
+template <class Policy>
+void Rvm<Policy>::run_interrupt_(Interrupt interrupt)
 {
   switch (interrupt) {
   case PutC :
-    std::cout << static_cast<char>(registers_[Ir]);
+    io_.putChar(static_cast<char>(registers_[Ir]));
     break;
   case PutS : {
-    for (auto strAdr = registers_[Ir]; stack_[strAdr] && strAdr < stack_.size(); strAdr++) {
-      std::cout << stack_[strAdr];
+    auto strAdr = registers_[Ir];
+    if (strAdr < memory_.size()) {
+      auto str = memory_.data() + strAdr;
+      auto rest = memory_.size() - strAdr;
+      auto end = static_cast<const uint8_t*>(std::memchr(str, 0, rest));
+      io_.write(reinterpret_cast<const char*>(str), end ? end - str : rest);
     }
     break;
   }
   case GetC :
-    registers_[Ir] = getchar();
+    if constexpr (Policy::replayed) {
+      registers_[Ir] = replayer_.input();
+    } else {
+      registers_[Ir] = io_.getChar();
+    }
+    if constexpr (Policy::recorded) {
+      recorder_.input(registers_[Ir]);
+    }
     break;
   case Halt :
     halted_ = true;
+    io_.flush();
     break;
   ABORT_IF_DEFAULT
   }
 }
 
-#undef EXPECT_REG_EXISTS
+#undef RAISE_ERROR
+#undef JUMP_TO
+#undef EXPECT_MEMORY
+#undef EXPECT_PROGRAM_FITS
+#undef CHARGE
+#undef PROFILE_BRANCH
+#undef FOLLOW_IP_WRITE
+#undef FETCH
+#undef DISPATCH_BEGIN
+#undef DISPATCH_END
+#undef HANDLER
+#undef DISPATCH
 #undef ABORT_IF_DEFAULT
 #undef FALLTHROUGH
 #undef NODISCARD
+#undef RVM_FORCEINLINE
 
+#ifdef _MSC_VER
 #pragma warning( pop )
+#endif
 
 #endif // RVM_HPP
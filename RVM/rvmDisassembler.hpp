@@ -0,0 +1,224 @@
+#ifndef RVM_DISASSEMBLER_HPP
+#define RVM_DISASSEMBLER_HPP
+
+#include <set>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+
+#include "rvmIsa.hpp"
+
+//
+//  RvmDisassembler - listing of program in format version 1, 2 or 3, which
+//  is source of assembler. Jump and call targets get labels "L<address>",
+//  every instruction is followed by its address in comment, data of
+//  sectioned program is listed with db in data section. Immediates and
+//  offsets are written as numbers, also those assembled from labels, so
+//  listing of code in version 1 assembles to the same bytes.
+//
+//  Byte which doesn't start valid instruction is listed as comment and
+//  listing goes on from the next byte, so is jump to address which is not
+//  start of instruction
+//
+
+class RvmDisassembler : RvmIsa
+{
+public:
+
+  //
+  //  returns false if program is malformed, listing has comment at every
+  //  malformed instruction then
+  //
+
+  bool disassemble(const std::vector<uint8_t>&, std::ostream&) const;
+
+private:
+
+  struct decoded_t
+  {
+    uint64_t adr;
+    fields_t insn;
+    bool valid;
+  };
+
+  static std::string text_(const fields_t&);
+
+  static constexpr size_t data_line_ = 16;
+};
+
+inline bool RvmDisassembler::disassemble(const std::vector<uint8_t>& program, std::ostream& out) const
+{
+  auto starts = [&](const uint8_t (&header)[4]) {
+    return program.size() >= sizeof(header) && std::equal(std::begin(header), std::end(header), program.begin());
+  };
+  bool compact = false;
+  bool sectioned = false;
+  uint64_t adr = 0;
+  uint64_t codeSize = program.size();
+  if (starts(CompactHeader)) {
+    compact = true;
+    adr = sizeof(CompactHeader);
+  } else if (starts(SectionedHeader) && program.size() >= SectionedHeaderSize) {
+    compact = program[4] == 2;
+    sectioned = true;
+    adr = SectionedHeaderSize;
+    uint64_t size = 0;
+    for (auto i = 8; i < 12; i++) {
+      size = size << 8 | program[i];
+    }
+    codeSize = std::min<uint64_t>(program.size(), adr + size);
+  }
+
+  //
+  //  as Rvm::decode_ does: in version 2 bits 5-4 of opcode are width of
+  //  number, jump targets are relative to the next instruction
+  //
+
+  auto fetch = [&](uint8_t bytes) -> uint64_t {
+    if (adr > codeSize || bytes > codeSize - adr) {
+      adr = codeSize + 1;
+      return 0;
+    }
+    uint64_t num = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+      num = num << 8 | program[adr++];
+    }
+    return num;
+  };
+  std::vector<decoded_t> code;
+  std::set<uint64_t> leaders;
+  while (adr < codeSize) {
+    decoded_t line{ adr, {}, false };
+    line.insn.op = static_cast<uint8_t>(fetch(1));
+    uint8_t width = Qword;
+    if (compact) {
+      width = line.insn.op >> 4 & 0x3;
+      line.insn.op &= 0xCF;
+    }
+    auto byte = [&] { return fetch(1); };
+    auto number = [&](bool target) -> uint64_t {
+      auto num = fetch(1 << width);
+      if (!target || !compact) {
+        return num;
+      }
+      auto shift = 64 - (8 << width);
+      return adr + (static_cast<int64_t>(num << shift) >> shift);
+    };
+    line.valid = decode(line.insn, byte, number) && adr <= codeSize
+      && line.insn.dst < RegSize && line.insn.src < RegSize;
+    if (line.valid) {
+      leaders.insert(line.adr);
+    } else {
+      adr = line.adr + 1;
+    }
+    code.push_back(line);
+  }
+
+  std::set<uint64_t> labels;
+  for (auto& line : code) {
+    if (!line.valid || (formats[line.insn.op] != JumpFormat && formats[line.insn.op] != CallFormat)) {
+      continue;
+    }
+    if (line.insn.imm == codeSize || leaders.count(line.insn.imm)) {
+      labels.insert(line.insn.imm);
+    } else {
+      line.valid = false;
+    }
+  }
+
+  bool ok = true;
+  out << "; format version " << (sectioned ? 3 : compact ? 2 : 1) << "\n";
+  for (const auto& line : code) {
+    if (labels.count(line.adr)) {
+      out << "L" << line.adr << ":\n";
+    }
+    if (line.valid) {
+      out << "    " << std::left << std::setw(32) << text_(line.insn) << "; " << line.adr << "\n";
+    } else {
+      out << "    ; invalid instruction " << +program[line.adr] << " at " << line.adr << "\n";
+      ok = false;
+    }
+  }
+  if (labels.count(codeSize)) {
+    out << "L" << codeSize << ":\n";
+  }
+  if (sectioned && codeSize < program.size()) {
+    out << "section data\n";
+    for (auto i = codeSize; i < program.size(); i += data_line_) {
+      out << "    db ";
+      for (auto j = i; j < std::min<uint64_t>(i + data_line_, program.size()); j++) {
+        out << (j == i ? "" : ", ") << +program[j];
+      }
+      out << "\n";
+    }
+  }
+  return ok;
+}
+
+//
+//  negative immediate or offset is its magnitude with top bit set, as
+//  assembler writes it
+//
+
+inline std::string RvmDisassembler::text_(const fields_t& insn)
+{
+  constexpr uint64_t signBit = uint64_t{ 1 } << 63;
+  std::ostringstream text;
+  auto address = [&](uint8_t reg) {
+    text << sizes[insn.size] << " [" << registers[reg];
+    if (insn.imm & signBit) {
+      text << " - " << (insn.imm & ~signBit);
+    } else if (insn.imm) {
+      text << " + " << insn.imm;
+    }
+    text << "]";
+  };
+  auto format = formats[insn.op];
+  text << (format == JumpFormat ? condition(insn) : mnemonics[insn.op]);
+  switch (format) {
+  case RegRegFormat:
+    text << " " << registers[insn.dst] << ", " << registers[insn.src];
+    break;
+  case MovFormat:
+    text << " ";
+    switch (insn.mode) {
+    case 0b00:
+      text << registers[insn.dst] << ", " << (insn.imm & signBit ? "-" : "") << (insn.imm & ~signBit);
+      break;
+    case 0b01:
+      text << registers[insn.dst] << ", " << registers[insn.src];
+      break;
+    case 0b10:
+      text << registers[insn.dst] << ", ";
+      address(insn.src);
+      break;
+    default:
+      address(insn.dst);
+      text << ", " << registers[insn.src];
+    }
+    break;
+  case StackFormat:
+    text << " " << sizes[insn.size] << " " << registers[insn.src];
+    break;
+  case JumpFormat: [[fallthrough]];
+  case CallFormat:
+    text << " L" << insn.imm;
+    break;
+  case ByteFormat:
+    text << " " << insn.imm;
+    break;
+  case RegFormat:
+    text << " " << registers[insn.src];
+    break;
+  default:
+    break;
+  }
+  return text.str();
+}
+
+#endif // RVM_DISASSEMBLER_HPP
@@ -0,0 +1,200 @@
+#ifndef RVM_IO_HPP
+#define RVM_IO_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//
+//  I/O devices used by PutC, PutS and GetC interrupts. Device is chosen by
+//  Policy::io_t and is reachable through Rvm::io(). Every device provides:
+//
+//    void putChar(char)                - PutC
+//    void write(const char*, size_t)   - PutS, whole string at once
+//    uint64_t getChar()                - GetC, ~0 on end of input
+//    void flush()                      - called on Halt and at end of program
+//
+
+//
+//  FdIo - buffered device over file descriptors. Output is collected in
+//  buffer and leaves with bulk write(2) calls, input is read by read(2) in
+//  blocks. Pending output is flushed before blocking on input, so prompts
+//  are seen before program waits for answer
+//
+
+class FdIo
+{
+public:
+
+  explicit FdIo(int = 1, int = 0, size_t = 1 << 16);
+  FdIo(const FdIo&) = delete;
+  FdIo& operator=(const FdIo&) = delete;
+  ~FdIo();
+
+  void putChar(char);
+  void write(const char*, size_t);
+  uint64_t getChar();
+  void flush();
+
+private:
+
+  static bool write_all_(int, const char*, size_t) noexcept;
+
+  int out_fd_;
+  int in_fd_;
+  std::vector<char> out_;
+  size_t out_used_ = 0;
+  std::vector<char> in_;
+  size_t in_pos_ = 0;
+  size_t in_end_ = 0;
+};
+
+inline FdIo::FdIo(int outFd, int inFd, size_t bufferSize) :
+  out_fd_(outFd),
+  in_fd_(inFd),
+  out_(bufferSize ? bufferSize : 1),
+  in_(bufferSize ? bufferSize : 1)
+{
+}
+
+inline FdIo::~FdIo()
+{
+  flush();
+}
+
+inline void FdIo::putChar(char c)
+{
+  if (out_used_ == out_.size()) {
+    flush();
+  }
+  out_[out_used_++] = c;
+}
+
+inline void FdIo::write(const char* str, size_t length)
+{
+  if (length > out_.size() - out_used_) {
+    flush();
+    if (length >= out_.size()) {
+      write_all_(out_fd_, str, length);
+      return;
+    }
+  }
+  std::memcpy(out_.data() + out_used_, str, length);
+  out_used_ += length;
+}
+
+inline uint64_t FdIo::getChar()
+{
+  if (in_pos_ == in_end_) {
+    flush();
+#ifdef _WIN32
+    auto got = _read(in_fd_, in_.data(), static_cast<unsigned>(in_.size()));
+#else
+    auto got = ::read(in_fd_, in_.data(), in_.size());
+#endif
+    if (got <= 0) {
+      return ~uint64_t{ 0 };
+    }
+    in_pos_ = 0;
+    in_end_ = static_cast<size_t>(got);
+  }
+  return static_cast<uint8_t>(in_[in_pos_++]);
+}
+
+inline void FdIo::flush()
+{
+  write_all_(out_fd_, out_.data(), out_used_);
+  out_used_ = 0;
+}
+
+inline bool FdIo::write_all_(int fd, const char* data, size_t length) noexcept
+{
+  while (length) {
+#ifdef _WIN32
+    auto done = _write(fd, data, static_cast<unsigned>(length));
+#else
+    auto done = ::write(fd, data, length);
+#endif
+    if (done <= 0) {
+      return false;
+    }
+    data += done;
+    length -= static_cast<size_t>(done);
+  }
+  return true;
+}
+
+//
+//  MemoryIo - in-memory sink and source for tests and benchmarks. Output
+//  is appended to sink(), GetC reads from string given by source
+//
+
+class MemoryIo
+{
+public:
+
+  void putChar(char);
+  void write(const char*, size_t);
+  uint64_t getChar();
+  void flush();
+
+  const std::string& sink() const noexcept;
+  void source(std::string);
+  void clear();
+
+private:
+
+  std::string sink_{};
+  std::string source_{};
+  size_t source_pos_ = 0;
+};
+
+inline void MemoryIo::putChar(char c)
+{
+  sink_.push_back(c);
+}
+
+inline void MemoryIo::write(const char* str, size_t length)
+{
+  sink_.append(str, length);
+}
+
+inline uint64_t MemoryIo::getChar()
+{
+  if (source_pos_ == source_.size()) {
+    return ~uint64_t{ 0 };
+  }
+  return static_cast<uint8_t>(source_[source_pos_++]);
+}
+
+inline void MemoryIo::flush()
+{
+}
+
+inline const std::string& MemoryIo::sink() const noexcept
+{
+  return sink_;
+}
+
+inline void MemoryIo::source(std::string input)
+{
+  source_ = std::move(input);
+  source_pos_ = 0;
+}
+
+inline void MemoryIo::clear()
+{
+  sink_.clear();
+  source_.clear();
+  source_pos_ = 0;
+}
+
+#endif // RVM_IO_HPP
@@ -0,0 +1,400 @@
+#ifndef RVM_ISA_HPP
+#define RVM_ISA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+//
+//  RVM_INSTRUCTIONS - instruction set of the machine, one row per opcode in
+//  order of opcode numbers: name, mnemonic, operand format and handler of
+//  Rvm which runs it (for Mov and Jmp handler of mode 0, handlers of other
+//  modes follow it). Opcodes, mnemonics and formats of RvmIsa, keywords of
+//  RasmLexer and dispatch table of Rvm are expanded from it, encoder and
+//  decoder below go by format. New instruction of existing format is one
+//  row here and its handler in Rvm
+//
+
+#define RVM_INSTRUCTIONS(X)            \
+  X(Add,  "add",  RegReg, Add   )      \
+  X(Sub,  "sub",  RegReg, Sub   )      \
+  X(And,  "and",  RegReg, And   )      \
+  X(Or,   "or",   RegReg, Or    )      \
+  X(Xor,  "xor",  RegReg, Xor   )      \
+  X(Not,  "not",  RegReg, Not   )      \
+  X(Mov,  "mov",  Mov,    MovImm)      \
+  X(Push, "push", Stack,  Push  )      \
+  X(Pop,  "pop",  Stack,  Pop   )      \
+  X(Jmp,  "jmp",  Jump,   Jmp   )      \
+  X(Call, "call", Call,   Call  )      \
+  X(Ret,  "ret",  Bare,   Ret   )      \
+  X(Int,  "int",  Byte,   Int   )      \
+  X(Cmp,  "cmp",  RegReg, Cmp   )      \
+  X(Test, "test", Reg,    Test  )
+
+struct RvmIsa
+{
+#define RVM_ISA_OPCODE(name, mnemonic, format, handler) name,
+  enum Opcodes : uint8_t
+  {
+    RVM_INSTRUCTIONS(RVM_ISA_OPCODE)
+    OpcodeSize
+  };
+#undef RVM_ISA_OPCODE
+
+  //
+  //  operands after opcode byte, number is immediate, offset or jump target,
+  //  8 bytes in format version 1:
+  //
+  //    RegReg - dst (4) | src (4)
+  //    Mov    - mode (2) | size (2) | dst (4) | [src (4) | 0000] | [number]
+  //    Stack  - reg (4) | size (2) | 00
+  //    Jump   - neg (1) | mode (2) | 00000 | number
+  //    Call   - number
+  //    Bare   - nothing
+  //    Byte   - number (8)
+  //    Reg    - src (4) | 0000
+  //
+  //  Mov has src unless mode is 00 and number unless mode is 01, see
+  //  decode. Version 2 is described at Rvm::decode_
+  //
+
+  enum Formats : uint8_t
+  {
+    RegRegFormat,
+    MovFormat,
+    StackFormat,
+    JumpFormat,
+    CallFormat,
+    BareFormat,
+    ByteFormat,
+    RegFormat
+  };
+
+  enum Registers : uint8_t
+  {
+    R0,
+    R1,
+    R2,
+    R3,
+    R4,
+    R5,
+    R6,
+    R7,
+
+    Ir,
+    Fg,
+    Ip,
+    Sp,
+    Bp,
+
+    RegSize
+  };
+
+  enum MemSize : uint8_t
+  {
+    Byte,
+    Word,
+    Dword,
+    Qword
+  };
+
+  //
+  //  condition of jump is neg bit and mode: mode 00 - always, 01 - if neg,
+  //  10 - if zero, 11 - if pos, neg bit inverts it. Several mnemonics may
+  //  name one condition, the first of them is its name in listings
+  //
+
+  struct condition_t
+  {
+    std::string_view mnemonic;
+    uint8_t neg;
+    uint8_t mode;
+  };
+
+  //
+  //  operands of one instruction, unused are zero
+  //
+
+  struct fields_t
+  {
+    uint8_t op;
+    uint8_t mode;
+    uint8_t size;
+    uint8_t dst;
+    uint8_t src;
+    bool neg;
+    uint64_t imm;
+  };
+
+#define RVM_ISA_MNEMONIC(name, mnemonic, format, handler) mnemonic,
+  static constexpr std::string_view mnemonics[] = { RVM_INSTRUCTIONS(RVM_ISA_MNEMONIC) };
+#undef RVM_ISA_MNEMONIC
+
+#define RVM_ISA_FORMAT(name, mnemonic, format, handler) format##Format,
+  static constexpr Formats formats[] = { RVM_INSTRUCTIONS(RVM_ISA_FORMAT) };
+#undef RVM_ISA_FORMAT
+
+  static constexpr std::string_view registers[] = {
+    "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
+    "ir", "fg", "ip", "sp", "bp"
+  };
+
+  static constexpr std::string_view sizes[] = { "byte", "word", "dword", "qword" };
+
+  static constexpr condition_t conditions[] = {
+    { "jmp", 0, 0b00 },
+    { "jn" , 0, 0b01 }, { "jnn", 1, 0b01 },
+    { "jz" , 0, 0b10 }, { "jnz", 1, 0b10 },
+    { "jp" , 0, 0b11 }, { "jnp", 1, 0b11 },
+    { "jl" , 0, 0b01 }, { "jge", 1, 0b01 },
+    { "je" , 0, 0b10 }, { "jne", 1, 0b10 },
+    { "jg" , 0, 0b11 }, { "jle", 1, 0b11 }
+  };
+
+  static_assert(std::size(registers) == RegSize);
+
+  //
+  //  bytecode of format version 2 starts with CompactHeader, sectioned
+  //  program of version 3 starts with SectionedHeader, see Rvm::decode_
+  //
+
+  static constexpr uint8_t CompactHeader[] = { 0xFF, 'R', 'V', 2 };
+  static constexpr uint8_t SectionedHeader[] = { 0xFF, 'R', 'V', 3 };
+  static constexpr uint64_t SectionedHeaderSize = 16;
+
+  //
+  //  reads operands of instruction, opcode of which is in insn.op. byte()
+  //  returns next byte, number(bool) next immediate or offset (false) or
+  //  jump target (true), so caller decides their width. Returns false if
+  //  opcode is unknown
+  //
+
+  template <class FetchByte, class FetchNumber>
+  static constexpr bool decode(fields_t& insn, FetchByte&& byte, FetchNumber&& number)
+  {
+    if (insn.op >= OpcodeSize) {
+      return false;
+    }
+    switch (formats[insn.op]) {
+      //
+      //  Add: 8 bit opcode + 4 bit dest reg + 4 bit src reg
+      //
+      //  for simplicity we cant do something like "add r0, [r1 + 20],
+      //  but this con be accomplished with mov, then add
+      //
+      //  Sub, And, Or, Xor, Not. Similar to add format
+      //
+      //  Cmp. Sub SndReg from FstReg, update flags, discard result
+      //
+      //  cmp (5), (5) -> zFlag -> je, jge, jle - true
+      //
+      //  cmp (5), (4) -> pFlag -> jg, jge, jne - true
+      //
+
+    case RegRegFormat: {
+      auto regs = byte();
+      insn.dst = regs >> 4 & 0xF;
+      insn.src = regs & 0xF;
+      break;
+    }
+
+      //
+      //  MOVE (COPY)
+      //
+      //  format: 8 bit opcode | mod + size? + dstReg + | srcReg / num
+      //
+      //  mode:
+      //
+      //  00 reg <- num            : opcode | 00 + 00 + (???? - dstReg) | num ...
+      //  01 reg <- reg            : opcode | 01 + 00 + (???? - dstReg) | (???? - srcReg) + 0000
+      //  10 reg <- [reg + offset] : opcode | 10 + (?? - movSize) + (???? - dstReg) | (???? - srcReg) +  0000 | num ...
+      //  11 [reg + offset] <- reg : opcode | 11 + (?? - movSize) + (???? - dstReg) | (???? - srcReg) + 0000 | num ...
+      //
+      //  examples:
+      //
+      //  MOV R0, qword [BP + 10]  ==  00000110 | 10'11'0000 | 1011'00'00 | 00001010
+      //  MOV word [BP - 512], R3  ==  00000110 | 11'01'1011 | 0011'01'00 | 11111101 | 11111111
+      //
+
+    case MovFormat: {
+      auto fstByte = byte();
+      insn.mode = fstByte >> 6 & 0x3;
+      insn.size = fstByte >> 4 & 0x3;
+      insn.dst = fstByte & 0xF;
+      if (insn.mode != 0b00) {
+        insn.src = byte() >> 4 & 0xF;
+      }
+      if (insn.mode != 0b01) {
+        insn.imm = number(false);
+      }
+      break;
+    }
+
+      //
+      //  push value of some size from reg to stack
+      //  pop value of some size to register
+      //
+      //  format: opcode | (????) - reg, (??) - size, 00
+      //
+
+    case StackFormat: {
+      auto sndByte = byte();
+      insn.src = insn.dst = sndByte >> 4 & 0xF;
+      insn.size = sndByte >> 2 & 0x3;
+      break;
+    }
+
+      //
+      //  jump somewhere
+      //
+      //  format: opcode | (?) - negBit, (??) - mode, 00000 | 64 bit dest
+      //
+      //  modes: 00 - if true
+      //         01 - if neg
+      //         10 - if zero
+      //         11 - if pos
+      //
+      //  example: opcode | 10100000 | ... - jump if not neg (jnn)
+      //
+      //  comment: jump if not true doesn't really exist, so combination of neg bit with 00 mode equivalent to 000
+      //
+
+    case JumpFormat: {
+      auto sndByte = byte();
+      insn.neg = sndByte >> 7 & 0x1;
+      insn.mode = sndByte >> 5 & 0x3;
+      insn.imm = number(true);
+      break;
+    }
+
+      //
+      //  push IP and jump
+      //
+      //  format: opcode | 64 bit of dest ip
+      //
+
+    case CallFormat:
+      insn.imm = number(true);
+      break;
+
+      //
+      //  pop IP and jump
+      //
+      //  format: opcode
+      //
+
+    case BareFormat:
+      break;
+
+      //
+      //  run interrupt using Interrupt Register (Ir)
+      //
+      //  format: opcode | int_num
+      //
+
+    case ByteFormat:
+      insn.imm = byte();
+      break;
+
+      //
+      //  update flags based on srcReg
+      //
+      //  format: opcode | (????) - srcReg 0000
+      //
+
+    case RegFormat:
+      insn.src = byte() >> 4 & 0xF;
+      break;
+    }
+    return true;
+  }
+
+  //
+  //  writes instruction: byte(uint8_t) takes next byte, number(imm, bool)
+  //  writes immediate or offset (false) or jump target (true) in width of
+  //  caller
+  //
+
+  template <class PutByte, class PutNumber>
+  static void encode(const fields_t& insn, PutByte&& byte, PutNumber&& number)
+  {
+    byte(insn.op);
+    switch (formats[insn.op]) {
+    case RegRegFormat:
+      byte(static_cast<uint8_t>(insn.dst << 4 | insn.src));
+      break;
+    case MovFormat:
+      byte(static_cast<uint8_t>(insn.mode << 6 | insn.size << 4 | insn.dst));
+      if (insn.mode != 0b00) {
+        byte(static_cast<uint8_t>(insn.src << 4));
+      }
+      if (insn.mode != 0b01) {
+        number(insn.imm, false);
+      }
+      break;
+    case StackFormat:
+      byte(static_cast<uint8_t>(insn.dst << 4 | insn.size << 2));
+      break;
+    case JumpFormat:
+      byte(static_cast<uint8_t>(insn.neg << 7 | insn.mode << 5));
+      number(insn.imm, true);
+      break;
+    case CallFormat:
+      number(insn.imm, true);
+      break;
+    case BareFormat:
+      break;
+    case ByteFormat:
+      byte(static_cast<uint8_t>(insn.imm));
+      break;
+    case RegFormat:
+      byte(static_cast<uint8_t>(insn.src << 4));
+      break;
+    }
+  }
+
+  //
+  //  instruction has number, which takes 1, 2, 4 or 8 bytes in format
+  //  version 2
+  //
+
+  static constexpr bool hasNumber(const fields_t& insn)
+  {
+    auto format = formats[insn.op];
+    return (format == MovFormat && insn.mode != 0b01) || format == JumpFormat || format == CallFormat;
+  }
+
+  static constexpr uint8_t length(const fields_t& insn, uint8_t numberBytes)
+  {
+    switch (formats[insn.op]) {
+    case MovFormat:
+      return 2 + (insn.mode != 0b00) + (insn.mode != 0b01 ? numberBytes : 0);
+    case JumpFormat:
+      return 2 + numberBytes;
+    case CallFormat:
+      return 1 + numberBytes;
+    case BareFormat:
+      return 1;
+    default:
+      return 2;
+    }
+  }
+
+  //
+  //  first mnemonic of condition of jump
+  //
+
+  static constexpr std::string_view condition(const fields_t& insn)
+  {
+    for (const auto& cond : conditions) {
+      if (cond.mode == insn.mode && (cond.neg == insn.neg || cond.mode == 0b00)) {
+        return cond.mnemonic;
+      }
+    }
+    return mnemonics[Jmp];
+  }
+};
+
+#endif // RVM_ISA_HPP
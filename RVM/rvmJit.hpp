@@ -0,0 +1,475 @@
+#ifndef RVM_JIT_HPP
+#define RVM_JIT_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RVM_JIT
+#endif
+
+#ifdef RVM_JIT
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//
+//  JitBuffer - page aligned memory for generated code. It is writable only
+//  between unlock() and lock(), and executable only outside of them
+//
+
+class JitBuffer
+{
+public:
+
+  explicit JitBuffer(size_t);
+  ~JitBuffer();
+
+  JitBuffer(const JitBuffer&) = delete;
+  JitBuffer& operator =(const JitBuffer&) = delete;
+
+  uint8_t* data() const noexcept;
+  size_t capacity() const noexcept;
+
+  void unlock();
+  void lock();
+
+private:
+
+  uint8_t* data_ = nullptr;
+  size_t capacity_ = 0;
+};
+
+inline JitBuffer::JitBuffer(size_t capacity) :
+  capacity_(capacity)
+{
+#ifdef _WIN32
+  data_ = static_cast<uint8_t*>(VirtualAlloc(nullptr, capacity_, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+  if (!data_) {
+    throw std::bad_alloc{};
+  }
+#else
+  auto mem = mmap(nullptr, capacity_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    throw std::bad_alloc{};
+  }
+  data_ = static_cast<uint8_t*>(mem);
+#endif
+}
+
+inline JitBuffer::~JitBuffer()
+{
+#ifdef _WIN32
+  VirtualFree(data_, 0, MEM_RELEASE);
+#else
+  munmap(data_, capacity_);
+#endif
+}
+
+inline uint8_t* JitBuffer::data() const noexcept
+{
+  return data_;
+}
+
+inline size_t JitBuffer::capacity() const noexcept
+{
+  return capacity_;
+}
+
+inline void JitBuffer::unlock()
+{
+#ifdef _WIN32
+  DWORD old;
+  VirtualProtect(data_, capacity_, PAGE_READWRITE, &old);
+#else
+  mprotect(data_, capacity_, PROT_READ | PROT_WRITE);
+#endif
+}
+
+inline void JitBuffer::lock()
+{
+#ifdef _WIN32
+  DWORD old;
+  VirtualProtect(data_, capacity_, PAGE_EXECUTE_READ, &old);
+  FlushInstructionCache(GetCurrentProcess(), data_, capacity_);
+#else
+  mprotect(data_, capacity_, PROT_READ | PROT_EXEC);
+#endif
+}
+
+//
+//  X64Emitter - appends x86-64 instructions to JitBuffer. Only forms needed
+//  by Rvm are here. Generated code keeps:
+//
+//  rbx - pointer to Rvm registers, so vm register n is qword [rbx + 8 * n]
+//  r12 - pointer to Rvm memory
+//  r13 - size of Rvm memory
+//
+//  rax, rcx, rdx are scratch. enter() is the only way into generated code:
+//  it saves pinned registers and jumps to given block. Blocks leave through
+//  exit(code), which returns code from enter()
+//
+
+class X64Emitter
+{
+public:
+
+  enum HostReg : uint8_t
+  {
+    Rax,
+    Rcx,
+    Rdx
+  };
+
+  enum Cond : uint8_t
+  {
+    Zero    = 0x84,
+    NotZero = 0x85,
+    Above   = 0x87
+  };
+
+  explicit X64Emitter(size_t = 16 << 20);
+
+  void reset();
+  void unlock();
+  void lock();
+
+  uint8_t* here() const noexcept;
+  size_t room() const noexcept;
+
+  uint64_t enter(const uint8_t*, uint64_t*, uint8_t*, uint64_t) const;
+
+  void load(HostReg, uint8_t);
+  void store(uint8_t, HostReg);
+  void storeImm(uint8_t, uint64_t);
+  void movImm(HostReg, uint64_t);
+  void addRegImm(uint8_t, uint8_t);
+  void subRegImm(uint8_t, uint8_t);
+  void testRegImm(uint8_t, uint8_t);
+
+  void add(HostReg, HostReg);
+  void sub(HostReg, HostReg);
+  void bitAnd(HostReg, HostReg);
+  void bitOr(HostReg, HostReg);
+  void bitXor(HostReg, HostReg);
+  void bitNot(HostReg);
+  void zeroExtend(uint8_t);
+
+  void flags(uint8_t);
+  uint8_t* checkRange(uint8_t);
+  void loadMem(uint8_t);
+  void storeMem(uint8_t);
+
+  uint8_t* jcc(Cond);
+  void jmp(const uint8_t*);
+  uint8_t* jmp();
+  void exit(uint32_t);
+  static void patch(uint8_t*, const uint8_t*);
+
+private:
+
+  using entry_t = uint64_t (*)(const uint8_t*, uint64_t*, uint8_t*, uint64_t);
+
+  void emit_(std::initializer_list<uint8_t>);
+  void emit_dword_(uint32_t);
+  void emit_qword_(uint64_t);
+
+  JitBuffer buffer_;
+  uint8_t* curr_ = nullptr;
+  uint8_t* epilogue_ = nullptr;
+};
+
+inline X64Emitter::X64Emitter(size_t capacity) :
+  buffer_(capacity)
+{
+  reset();
+}
+
+inline void X64Emitter::reset()
+{
+  buffer_.unlock();
+  curr_ = buffer_.data();
+
+  //
+  //  trampoline: push rbx / push r12 / push r13,
+  //  pin registers, memory and its size, jump to block
+  //
+
+  emit_({ 0x53, 0x41, 0x54, 0x41, 0x55 });
+#ifdef _WIN32
+  emit_({ 0x48, 0x89, 0xD3, 0x4D, 0x89, 0xC4, 0x4D, 0x89, 0xCD, 0xFF, 0xE1 });
+#else
+  emit_({ 0x48, 0x89, 0xF3, 0x49, 0x89, 0xD4, 0x49, 0x89, 0xCD, 0xFF, 0xE7 });
+#endif
+
+  //
+  //  epilogue: pop r13 / pop r12 / pop rbx / ret
+  //
+
+  epilogue_ = curr_;
+  emit_({ 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3 });
+  buffer_.lock();
+}
+
+inline void X64Emitter::unlock()
+{
+  buffer_.unlock();
+}
+
+inline void X64Emitter::lock()
+{
+  buffer_.lock();
+}
+
+inline uint8_t* X64Emitter::here() const noexcept
+{
+  return curr_;
+}
+
+inline size_t X64Emitter::room() const noexcept
+{
+  return buffer_.capacity() - (curr_ - buffer_.data());
+}
+
+inline uint64_t X64Emitter::enter(const uint8_t* block, uint64_t* registers, uint8_t* memory, uint64_t size) const
+{
+  return reinterpret_cast<entry_t>(buffer_.data())(block, registers, memory, size);
+}
+
+//
+//  mov host, qword [rbx + 8 * reg]
+//
+
+inline void X64Emitter::load(HostReg host, uint8_t reg)
+{
+  emit_({ 0x48, 0x8B, uint8_t(0x43 | host << 3), uint8_t(reg << 3) });
+}
+
+//
+//  mov qword [rbx + 8 * reg], host
+//
+
+inline void X64Emitter::store(uint8_t reg, HostReg host)
+{
+  emit_({ 0x48, 0x89, uint8_t(0x43 | host << 3), uint8_t(reg << 3) });
+}
+
+inline void X64Emitter::storeImm(uint8_t reg, uint64_t imm)
+{
+  if (imm < 0x80000000) {
+    emit_({ 0x48, 0xC7, 0x43, uint8_t(reg << 3) });
+    emit_dword_(static_cast<uint32_t>(imm));
+  } else {
+    movImm(Rax, imm);
+    store(reg, Rax);
+  }
+}
+
+inline void X64Emitter::movImm(HostReg host, uint64_t imm)
+{
+  emit_({ 0x48, uint8_t(0xB8 | host) });
+  emit_qword_(imm);
+}
+
+inline void X64Emitter::addRegImm(uint8_t reg, uint8_t imm)
+{
+  emit_({ 0x48, 0x83, 0x43, uint8_t(reg << 3), imm });
+}
+
+inline void X64Emitter::subRegImm(uint8_t reg, uint8_t imm)
+{
+  emit_({ 0x48, 0x83, 0x6B, uint8_t(reg << 3), imm });
+}
+
+//
+//  test byte [rbx + 8 * reg], imm
+//
+
+inline void X64Emitter::testRegImm(uint8_t reg, uint8_t imm)
+{
+  emit_({ 0xF6, 0x43, uint8_t(reg << 3), imm });
+}
+
+inline void X64Emitter::add(HostReg dst, HostReg src)
+{
+  emit_({ 0x48, 0x01, uint8_t(0xC0 | src << 3 | dst) });
+}
+
+inline void X64Emitter::sub(HostReg dst, HostReg src)
+{
+  emit_({ 0x48, 0x29, uint8_t(0xC0 | src << 3 | dst) });
+}
+
+inline void X64Emitter::bitAnd(HostReg dst, HostReg src)
+{
+  emit_({ 0x48, 0x21, uint8_t(0xC0 | src << 3 | dst) });
+}
+
+inline void X64Emitter::bitOr(HostReg dst, HostReg src)
+{
+  emit_({ 0x48, 0x09, uint8_t(0xC0 | src << 3 | dst) });
+}
+
+inline void X64Emitter::bitXor(HostReg dst, HostReg src)
+{
+  emit_({ 0x48, 0x31, uint8_t(0xC0 | src << 3 | dst) });
+}
+
+inline void X64Emitter::bitNot(HostReg dst)
+{
+  emit_({ 0x48, 0xF7, uint8_t(0xD0 | dst) });
+}
+
+//
+//  clear rax above given size: movzx eax, al / movzx eax, ax / mov eax, eax
+//
+
+inline void X64Emitter::zeroExtend(uint8_t size)
+{
+  switch (size) {
+  case 0 : emit_({ 0x0F, 0xB6, 0xC0 }); break;
+  case 1 : emit_({ 0x0F, 0xB7, 0xC0 }); break;
+  case 2 : emit_({ 0x89, 0xC0 }); break;
+  default: break;
+  }
+}
+
+//
+//  qword [rbx + 8 * reg] = rax == 0 ? zero : rax < 0 ? neg : pos,
+//  clobbers rcx and rdx
+//
+
+inline void X64Emitter::flags(uint8_t reg)
+{
+  emit_({ 0x48, 0x85, 0xC0 });
+  emit_({ 0xB9, 0x04, 0x00, 0x00, 0x00 });
+  emit_({ 0xBA, 0x01, 0x00, 0x00, 0x00 });
+  emit_({ 0x0F, 0x48, 0xCA });
+  emit_({ 0xBA, 0x02, 0x00, 0x00, 0x00 });
+  emit_({ 0x0F, 0x44, 0xCA });
+  store(reg, Rcx);
+}
+
+//
+//  jump if [rax, rax + bytes) is not inside memory, clobbers rdx.
+//  Returns jump to patch
+//
+
+inline uint8_t* X64Emitter::checkRange(uint8_t bytes)
+{
+  emit_({ 0x4C, 0x89, 0xEA });
+  emit_({ 0x48, 0x83, 0xEA, bytes });
+  emit_({ 0x48, 0x39, 0xD0 });
+  return jcc(Above);
+}
+
+//
+//  rax = big endian number of given size at [r12 + rax]
+//
+
+inline void X64Emitter::loadMem(uint8_t size)
+{
+  switch (size) {
+  case 0 :
+    emit_({ 0x41, 0x0F, 0xB6, 0x04, 0x04 });
+    break;
+  case 1 :
+    emit_({ 0x41, 0x0F, 0xB7, 0x04, 0x04 });
+    emit_({ 0x66, 0xC1, 0xC0, 0x08 });
+    break;
+  case 2 :
+    emit_({ 0x41, 0x8B, 0x04, 0x04 });
+    emit_({ 0x0F, 0xC8 });
+    break;
+  default:
+    emit_({ 0x49, 0x8B, 0x04, 0x04 });
+    emit_({ 0x48, 0x0F, 0xC8 });
+  }
+}
+
+//
+//  store rcx of given size to [r12 + rax] in big endian, clobbers rcx
+//
+
+inline void X64Emitter::storeMem(uint8_t size)
+{
+  switch (size) {
+  case 0 :
+    emit_({ 0x41, 0x88, 0x0C, 0x04 });
+    break;
+  case 1 :
+    emit_({ 0x66, 0xC1, 0xC1, 0x08 });
+    emit_({ 0x66, 0x41, 0x89, 0x0C, 0x04 });
+    break;
+  case 2 :
+    emit_({ 0x0F, 0xC9 });
+    emit_({ 0x41, 0x89, 0x0C, 0x04 });
+    break;
+  default:
+    emit_({ 0x48, 0x0F, 0xC9 });
+    emit_({ 0x49, 0x89, 0x0C, 0x04 });
+  }
+}
+
+inline uint8_t* X64Emitter::jcc(Cond cond)
+{
+  emit_({ 0x0F, cond });
+  auto at = curr_;
+  emit_dword_(0);
+  return at;
+}
+
+inline void X64Emitter::jmp(const uint8_t* dst)
+{
+  patch(jmp(), dst);
+}
+
+inline uint8_t* X64Emitter::jmp()
+{
+  emit_({ 0xE9 });
+  auto at = curr_;
+  emit_dword_(0);
+  return at;
+}
+
+inline void X64Emitter::exit(uint32_t code)
+{
+  emit_({ 0xB8 });
+  emit_dword_(code);
+  jmp(epilogue_);
+}
+
+inline void X64Emitter::patch(uint8_t* at, const uint8_t* dst)
+{
+  auto rel = static_cast<int32_t>(dst - (at + 4));
+  std::memcpy(at, &rel, 4);
+}
+
+inline void X64Emitter::emit_(std::initializer_list<uint8_t> bytes)
+{
+  for (auto b : bytes) {
+    *curr_++ = b;
+  }
+}
+
+inline void X64Emitter::emit_dword_(uint32_t x)
+{
+  std::memcpy(curr_, &x, 4);
+  curr_ += 4;
+}
+
+inline void X64Emitter::emit_qword_(uint64_t x)
+{
+  std::memcpy(curr_, &x, 8);
+  curr_ += 8;
+}
+
+#endif // RVM_JIT
+
+#endif // RVM_JIT_HPP
@@ -0,0 +1,472 @@
+#ifndef RVM_MEMORY_HPP
+#define RVM_MEMORY_HPP
+
+#include <new>
+#include <ios>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//
+//  RvmCode - read-only bytecode shared by any number of machines. Made from
+//  file, it is mapped from it without reading, and machines map its pages
+//  copy-on-write into their memory, so code is never copied while nobody
+//  writes to it. File must not change while it is mapped. Made from bytes,
+//  it keeps them and machines copy them
+//
+
+class RvmCode
+{
+public:
+
+  explicit RvmCode(const std::string&);
+  explicit RvmCode(std::vector<uint8_t>);
+  ~RvmCode();
+
+  RvmCode(const RvmCode&) = delete;
+  RvmCode& operator =(const RvmCode&) = delete;
+
+  const uint8_t* data() const noexcept;
+  uint64_t size() const noexcept;
+
+private:
+
+  friend class RvmMemory;
+
+  std::vector<uint8_t> bytes_{};
+  const uint8_t* data_ = nullptr;
+  uint64_t size_ = 0;
+#ifdef _WIN32
+  HANDLE mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+//
+//  RvmImage - frozen copy of guest memory in anonymous shared memory object.
+//  Machines made from image map it copy-on-write, so they share its pages
+//  until they write to them
+//
+
+class RvmImage
+{
+public:
+
+  RvmImage(const uint8_t*, uint64_t);
+  ~RvmImage();
+
+  RvmImage(const RvmImage&) = delete;
+  RvmImage& operator =(const RvmImage&) = delete;
+
+  uint64_t size() const noexcept;
+
+private:
+
+  friend class RvmMemory;
+
+#ifdef _WIN32
+  HANDLE handle_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+  uint64_t size_;
+};
+
+//
+//  RvmMemory - flat guest memory. Numbers are stored big endian, every
+//  access is one unaligned host load or store plus byte swap. Size of access
+//  is given as in bytecode: 0 - byte, 1 - word, 2 - dword, 3 - qword.
+//
+//  read and write don't check bounds, caller checks whole range once
+//  with contains
+//
+//  Memory is mapped from OS, so pages are zeroed lazily on first touch.
+//  freeze() moves contents to RvmImage and remaps memory as its private
+//  copy, memory made from image is private copy as well
+//
+
+class RvmMemory
+{
+public:
+
+  explicit RvmMemory(uint64_t);
+  explicit RvmMemory(const RvmImage&);
+  ~RvmMemory();
+
+  RvmMemory(const RvmMemory&) = delete;
+  RvmMemory& operator =(const RvmMemory&) = delete;
+
+  std::shared_ptr<const RvmImage> freeze();
+  void attach(const RvmCode&);
+
+  uint8_t* data() noexcept;
+  const uint8_t* data() const noexcept;
+  uint64_t size() const noexcept;
+
+  bool contains(uint64_t, uint64_t) const noexcept;
+
+  uint64_t read(uint8_t, uint64_t) const noexcept;
+  void write(uint8_t, uint64_t, uint64_t) noexcept;
+
+private:
+
+  static uint16_t swap_(uint16_t) noexcept;
+  static uint32_t swap_(uint32_t) noexcept;
+  static uint64_t swap_(uint64_t) noexcept;
+
+  friend class RvmImage;
+
+  static size_t length_(uint64_t) noexcept;
+  void map_(const RvmImage&);
+  void unmap_() noexcept;
+
+  uint8_t* data_ = nullptr;
+  uint64_t size_;
+#ifdef _WIN32
+  bool view_ = false;
+#endif
+};
+
+//
+//  mappings are never empty, so zero sized memory still has valid pointer
+//
+
+inline size_t RvmMemory::length_(uint64_t size) noexcept
+{
+  return size ? static_cast<size_t>(size) : 1;
+}
+
+inline RvmCode::RvmCode(const std::string& file)
+{
+#ifdef _WIN32
+  auto handle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  LARGE_INTEGER size{};
+  if (handle == INVALID_HANDLE_VALUE || !GetFileSizeEx(handle, &size)) {
+    if (handle != INVALID_HANDLE_VALUE) {
+      CloseHandle(handle);
+    }
+    throw std::ios_base::failure{ "could not open " + file };
+  }
+  size_ = static_cast<uint64_t>(size.QuadPart);
+  if (size_) {
+    mapping_ = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data_ = mapping_ ? static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+  }
+  CloseHandle(handle);
+  if (size_ && !data_) {
+    if (mapping_) {
+      CloseHandle(mapping_);
+    }
+    throw std::ios_base::failure{ "could not map " + file };
+  }
+#else
+  fd_ = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat info{};
+  if (fd_ < 0 || fstat(fd_, &info) != 0) {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    throw std::ios_base::failure{ "could not open " + file };
+  }
+  size_ = static_cast<uint64_t>(info.st_size);
+  if (!size_) {
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+  auto mem = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (mem == MAP_FAILED) {
+    close(fd_);
+    throw std::ios_base::failure{ "could not map " + file };
+  }
+  data_ = static_cast<const uint8_t*>(mem);
+#endif
+}
+
+inline RvmCode::RvmCode(std::vector<uint8_t> bytes) :
+  bytes_(std::move(bytes)),
+  data_(bytes_.data()),
+  size_(bytes_.size())
+{
+}
+
+inline RvmCode::~RvmCode()
+{
+  if (bytes_.data() == data_) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(data_);
+  CloseHandle(mapping_);
+#else
+  munmap(const_cast<uint8_t*>(data_), size_);
+  close(fd_);
+#endif
+}
+
+inline const uint8_t* RvmCode::data() const noexcept
+{
+  return data_;
+}
+
+inline uint64_t RvmCode::size() const noexcept
+{
+  return size_;
+}
+
+inline RvmImage::RvmImage(const uint8_t* data, uint64_t size) :
+  size_(size)
+{
+  auto length = RvmMemory::length_(size);
+#ifdef _WIN32
+  handle_ = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+    static_cast<DWORD>(uint64_t(length) >> 32), static_cast<DWORD>(length), nullptr);
+  if (!handle_) {
+    throw std::bad_alloc{};
+  }
+  auto view = MapViewOfFile(handle_, FILE_MAP_WRITE, 0, 0, length);
+  if (!view) {
+    CloseHandle(handle_);
+    throw std::bad_alloc{};
+  }
+  std::memcpy(view, data, size);
+  UnmapViewOfFile(view);
+#else
+#ifdef __linux__
+  fd_ = memfd_create("rvm-image", 0);
+#else
+  char name[] = "/tmp/rvm-image-XXXXXX";
+  fd_ = mkstemp(name);
+  if (fd_ >= 0) {
+    unlink(name);
+  }
+#endif
+  if (fd_ < 0) {
+    throw std::bad_alloc{};
+  }
+  auto view = ftruncate(fd_, length) == 0
+    ? mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0) : MAP_FAILED;
+  if (view == MAP_FAILED) {
+    close(fd_);
+    throw std::bad_alloc{};
+  }
+  std::memcpy(view, data, size);
+  munmap(view, length);
+#endif
+}
+
+inline RvmImage::~RvmImage()
+{
+#ifdef _WIN32
+  CloseHandle(handle_);
+#else
+  close(fd_);
+#endif
+}
+
+inline uint64_t RvmImage::size() const noexcept
+{
+  return size_;
+}
+
+inline RvmMemory::RvmMemory(uint64_t size) :
+  size_(size)
+{
+#ifdef _WIN32
+  data_ = static_cast<uint8_t*>(VirtualAlloc(nullptr, length_(size_), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+  if (!data_) {
+    throw std::bad_alloc{};
+  }
+#else
+  auto mem = mmap(nullptr, length_(size_), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    throw std::bad_alloc{};
+  }
+  data_ = static_cast<uint8_t*>(mem);
+#endif
+}
+
+inline RvmMemory::RvmMemory(const RvmImage& image) :
+  size_(image.size())
+{
+  map_(image);
+}
+
+inline RvmMemory::~RvmMemory()
+{
+  unmap_();
+}
+
+//
+//  on POSIX private mapping replaces old one at the same address, so
+//  data() doesn't change. On Windows view is mapped anew
+//
+
+inline std::shared_ptr<const RvmImage> RvmMemory::freeze()
+{
+  auto image = std::make_shared<const RvmImage>(data_, size_);
+  map_(*image);
+  return image;
+}
+
+inline void RvmMemory::map_(const RvmImage& image)
+{
+  auto length = length_(size_);
+#ifdef _WIN32
+  auto view = static_cast<uint8_t*>(MapViewOfFile(image.handle_, FILE_MAP_COPY, 0, 0, length));
+  if (!view) {
+    throw std::bad_alloc{};
+  }
+  unmap_();
+  data_ = view;
+  view_ = true;
+#else
+  auto flags = MAP_PRIVATE | (data_ ? MAP_FIXED : 0);
+  auto mem = mmap(data_, length, PROT_READ | PROT_WRITE, flags, image.fd_, 0);
+  if (mem == MAP_FAILED) {
+    throw std::bad_alloc{};
+  }
+  data_ = static_cast<uint8_t*>(mem);
+#endif
+}
+
+inline void RvmMemory::unmap_() noexcept
+{
+  if (!data_) {
+    return;
+  }
+#ifdef _WIN32
+  if (view_) {
+    UnmapViewOfFile(data_);
+  } else {
+    VirtualFree(data_, 0, MEM_RELEASE);
+  }
+#else
+  munmap(data_, length_(size_));
+#endif
+  data_ = nullptr;
+}
+
+//
+//  puts code at address 0. Size of code must not exceed size of memory
+//
+
+inline void RvmMemory::attach(const RvmCode& code)
+{
+#ifndef _WIN32
+  if (code.fd_ >= 0) {
+    auto mem = mmap(data_, code.size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, code.fd_, 0);
+    if (mem != MAP_FAILED) {
+      return;
+    }
+  }
+#endif
+  std::memcpy(data_, code.data_, code.size_);
+}
+
+inline uint8_t* RvmMemory::data() noexcept
+{
+  return data_;
+}
+
+inline const uint8_t* RvmMemory::data() const noexcept
+{
+  return data_;
+}
+
+inline uint64_t RvmMemory::size() const noexcept
+{
+  return size_;
+}
+
+inline bool RvmMemory::contains(uint64_t adr, uint64_t bytes) const noexcept
+{
+  return adr <= size_ && bytes <= size_ - adr;
+}
+
+inline uint64_t RvmMemory::read(uint8_t size, uint64_t adr) const noexcept
+{
+  auto src = data_ + adr;
+  switch (size) {
+  case 0 :
+    return *src;
+  case 1 : {
+    uint16_t x;
+    std::memcpy(&x, src, sizeof x);
+    return swap_(x);
+  }
+  case 2 : {
+    uint32_t x;
+    std::memcpy(&x, src, sizeof x);
+    return swap_(x);
+  }
+  default : {
+    uint64_t x;
+    std::memcpy(&x, src, sizeof x);
+    return swap_(x);
+  }
+  }
+}
+
+inline void RvmMemory::write(uint8_t size, uint64_t adr, uint64_t num) noexcept
+{
+  auto dst = data_ + adr;
+  switch (size) {
+  case 0 :
+    *dst = static_cast<uint8_t>(num);
+    break;
+  case 1 : {
+    auto x = swap_(static_cast<uint16_t>(num));
+    std::memcpy(dst, &x, sizeof x);
+    break;
+  }
+  case 2 : {
+    auto x = swap_(static_cast<uint32_t>(num));
+    std::memcpy(dst, &x, sizeof x);
+    break;
+  }
+  default : {
+    auto x = swap_(num);
+    std::memcpy(dst, &x, sizeof x);
+  }
+  }
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+
+inline uint16_t RvmMemory::swap_(uint16_t x) noexcept { return x; }
+inline uint32_t RvmMemory::swap_(uint32_t x) noexcept { return x; }
+inline uint64_t RvmMemory::swap_(uint64_t x) noexcept { return x; }
+
+#elif defined(_MSC_VER)
+
+inline uint16_t RvmMemory::swap_(uint16_t x) noexcept { return _byteswap_ushort(x); }
+inline uint32_t RvmMemory::swap_(uint32_t x) noexcept { return _byteswap_ulong(x); }
+inline uint64_t RvmMemory::swap_(uint64_t x) noexcept { return _byteswap_uint64(x); }
+
+#else
+
+inline uint16_t RvmMemory::swap_(uint16_t x) noexcept { return __builtin_bswap16(x); }
+inline uint32_t RvmMemory::swap_(uint32_t x) noexcept { return __builtin_bswap32(x); }
+inline uint64_t RvmMemory::swap_(uint64_t x) noexcept { return __builtin_bswap64(x); }
+
+#endif
+
+#endif // RVM_MEMORY_HPP
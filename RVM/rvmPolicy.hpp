@@ -0,0 +1,109 @@
+#ifndef RVM_POLICY_HPP
+#define RVM_POLICY_HPP
+
+#include <cstdint>
+#include <iostream>
+
+#include "rvmIo.hpp"
+
+//
+//  Execution policies for Rvm. Policy is a template parameter, so every
+//  choice below is resolved at compile time and costs nothing in hot loop:
+//
+//    exceptions - throw std::runtime_error on error, otherwise return status
+//    checked    - check memory bounds and register numbers
+//    traced     - call Policy::trace before every instruction
+//    profiled   - count executed instructions, see rvmProfile.hpp
+//    sampled    - sample guest call stack, see rvmSampler.hpp
+//    recorded   - record execution trace, see rvmRecord.hpp
+//    replayed   - replay execution trace instead of reading input
+//    io_t       - device used by PutC, PutS and GetC interrupts, see rvmIo.hpp
+//
+
+struct RvmPolicy
+{
+  static constexpr bool exceptions = true;
+  static constexpr bool checked    = true;
+  static constexpr bool traced     = false;
+  static constexpr bool profiled   = false;
+  static constexpr bool sampled    = false;
+  static constexpr bool recorded   = false;
+  static constexpr bool replayed   = false;
+
+  using io_t = FdIo;
+
+  static void trace(uint64_t, uint8_t, const uint64_t*) noexcept
+  {
+  }
+};
+
+struct RvmNoexceptPolicy : RvmPolicy
+{
+  static constexpr bool exceptions = false;
+};
+
+//
+//  Only for trusted bytecode: out of bounds access is undefined behaviour
+//
+
+struct RvmUncheckedPolicy : RvmPolicy
+{
+  static constexpr bool checked = false;
+};
+
+//
+//  Prints address, opcode and general purpose registers of every executed
+//  instruction to std::cerr
+//
+
+struct RvmTracePolicy : RvmNoexceptPolicy
+{
+  static constexpr bool traced = true;
+
+  static void trace(uint64_t adr, uint8_t op, const uint64_t* registers)
+  {
+    std::cerr << adr << ": op " << static_cast<int>(op);
+    for (int reg = 0; reg < 8; reg++) {
+      std::cerr << " r" << reg << '=' << registers[reg];
+    }
+    std::cerr << '\n';
+  }
+};
+
+//
+//  Collects RvmProfile, available through Rvm::profile()
+//
+
+struct RvmProfilePolicy : RvmNoexceptPolicy
+{
+  static constexpr bool profiled = true;
+};
+
+//
+//  Collects call stack samples, available through Rvm::sampler()
+//
+
+struct RvmSamplePolicy : RvmNoexceptPolicy
+{
+  static constexpr bool sampled = true;
+};
+
+//
+//  Records trace to stream given to Rvm::recorder().open
+//
+
+struct RvmRecordPolicy : RvmNoexceptPolicy
+{
+  static constexpr bool recorded = true;
+};
+
+//
+//  Replays trace given to Rvm::replayer().open, GetC reads recorded input
+//
+
+struct RvmReplayPolicy : RvmNoexceptPolicy
+{
+  static constexpr bool replayed = true;
+};
+
+#endif // RVM_POLICY_HPP
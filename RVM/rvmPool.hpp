@@ -0,0 +1,172 @@
+#ifndef RVM_POOL_HPP
+#define RVM_POOL_HPP
+
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "rvm.hpp"
+
+//
+//  Output of pooled machines is captured in memory, errors are returned
+//  as status
+//
+
+struct RvmPoolPolicy : RvmNoexceptPolicy
+{
+  using io_t = MemoryIo;
+};
+
+//
+//  RvmPool - runs many independent programs on worker threads. Every job
+//  gets its own Rvm, bytecode is shared between jobs as RvmCode. Jobs are
+//  dealt to per-worker deques; worker takes from the back of its own deque
+//  and, when it is empty, steals from the front of others. Each job has
+//  its own result slot, so results are stored without locking
+//
+
+template <class Policy = RvmPoolPolicy>
+class RvmPool
+{
+public:
+
+  using program_t = std::shared_ptr<const RvmCode>;
+
+  struct result_t
+  {
+    bool ok;
+    std::string message;
+    std::string output;
+  };
+
+  explicit RvmPool(size_t = std::thread::hardware_concurrency(), uint64_t = 10000);
+
+  size_t add(program_t, std::string = {});
+  std::vector<result_t> run();
+
+private:
+
+  struct job_t
+  {
+    program_t program;
+    std::string input;
+  };
+
+  struct worker_t
+  {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+  };
+
+  bool next_(size_t, size_t&);
+  void work_(size_t);
+  void run_job_(size_t);
+
+  size_t workers_count_;
+  uint64_t memory_size_;
+  size_t active_ = 0;
+  std::vector<job_t> jobs_{};
+  std::vector<result_t> results_{};
+  std::unique_ptr<worker_t[]> workers_{};
+};
+
+template <class Policy>
+RvmPool<Policy>::RvmPool(size_t workers, uint64_t memorySize) :
+  workers_count_(workers ? workers : 1),
+  memory_size_(memorySize)
+{
+}
+
+template <class Policy>
+size_t RvmPool<Policy>::add(program_t program, std::string input)
+{
+  jobs_.push_back({ std::move(program), std::move(input) });
+  return jobs_.size() - 1;
+}
+
+//
+//  runs all added jobs, returns results in order of add. Pool is empty after
+//
+
+template <class Policy>
+std::vector<typename RvmPool<Policy>::result_t> RvmPool<Policy>::run()
+{
+  results_.assign(jobs_.size(), {});
+  active_ = std::min(workers_count_, std::max<size_t>(jobs_.size(), 1));
+  workers_ = std::make_unique<worker_t[]>(active_);
+  for (size_t i = 0; i < jobs_.size(); i++) {
+    workers_[i % active_].jobs.push_back(i);
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < active_; i++) {
+    threads.emplace_back(&RvmPool::work_, this, i);
+  }
+  work_(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  jobs_.clear();
+  workers_.reset();
+  return std::move(results_);
+}
+
+//
+//  no jobs are added while pool runs, so worker may stop as soon as every
+//  deque was seen empty
+//
+
+template <class Policy>
+bool RvmPool<Policy>::next_(size_t self, size_t& job)
+{
+  {
+    auto& own = workers_[self];
+    std::lock_guard<std::mutex> guard{ own.lock };
+    if (!own.jobs.empty()) {
+      job = own.jobs.back();
+      own.jobs.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < active_; i++) {
+    auto& victim = workers_[(self + i) % active_];
+    std::lock_guard<std::mutex> guard{ victim.lock };
+    if (!victim.jobs.empty()) {
+      job = victim.jobs.front();
+      victim.jobs.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+template <class Policy>
+void RvmPool<Policy>::work_(size_t self)
+{
+  size_t job;
+  while (next_(self, job)) {
+    run_job_(job);
+  }
+}
+
+template <class Policy>
+void RvmPool<Policy>::run_job_(size_t job)
+{
+  auto& result = results_[job];
+  try {
+    auto vm = std::make_unique<Rvm<Policy>>(memory_size_);
+    vm->io().source(std::move(jobs_[job].input));
+    auto status = vm->run(*jobs_[job].program);
+    result.ok = status.ok;
+    result.message = std::move(status.message);
+    result.output = vm->io().sink();
+  } catch (const std::exception& e) {
+    result.ok = false;
+    result.message = e.what();
+  }
+}
+
+#endif // RVM_POOL_HPP
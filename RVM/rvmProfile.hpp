@@ -0,0 +1,151 @@
+#ifndef RVM_PROFILE_HPP
+#define RVM_PROFILE_HPP
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <ostream>
+#include <algorithm>
+
+#include "rvmIsa.hpp"
+
+//
+//  RvmProfile - execution counters collected by Rvm when Policy::profiled
+//  is set: executions of every opcode, Mov mode and size and interrupt,
+//  hits of every instruction address, taken and not taken counts of every
+//  conditional jump. Counters are kept from load of program
+//
+
+class RvmProfile
+{
+public:
+
+  void reset(uint64_t);
+
+  void instruction(uint64_t, uint8_t);
+  void mov(uint8_t, uint8_t);
+  void interrupt(uint64_t);
+  void branch(uint64_t, bool);
+
+  uint64_t hits(uint64_t) const noexcept;
+
+  //
+  //  writes report sorted by count, top instructions only
+  //
+
+  void dump(std::ostream&, size_t = 20) const;
+
+private:
+
+  using counters_t = std::vector<std::pair<uint64_t, size_t>>;
+
+  template <size_t N, class Name>
+  static void dump_table_(std::ostream&, const char*, const std::array<uint64_t, N>&, const Name*);
+  static counters_t sorted_(const std::vector<uint64_t>&);
+
+  std::array<uint64_t, RvmIsa::OpcodeSize> opcodes_{};
+  std::array<uint64_t, 16> movs_{};
+  std::array<uint64_t, 4> interrupts_{};
+  std::vector<uint64_t> hits_{};
+  std::vector<uint64_t> taken_{};
+  std::vector<uint64_t> not_taken_{};
+};
+
+inline void RvmProfile::reset(uint64_t codeSize)
+{
+  opcodes_.fill(0);
+  movs_.fill(0);
+  interrupts_.fill(0);
+  hits_.assign(codeSize, 0);
+  taken_.assign(codeSize, 0);
+  not_taken_.assign(codeSize, 0);
+}
+
+inline void RvmProfile::instruction(uint64_t adr, uint8_t op)
+{
+  ++hits_[adr];
+  ++opcodes_[op];
+}
+
+//
+//  mode 00 and 01 of Mov have no size, they are counted as size 0
+//
+
+inline void RvmProfile::mov(uint8_t mode, uint8_t size)
+{
+  ++movs_[mode << 2 | (mode < 2 ? 0 : size)];
+}
+
+inline void RvmProfile::interrupt(uint64_t id)
+{
+  ++interrupts_[id];
+}
+
+inline void RvmProfile::branch(uint64_t adr, bool taken)
+{
+  ++(taken ? taken_ : not_taken_)[adr];
+}
+
+inline uint64_t RvmProfile::hits(uint64_t adr) const noexcept
+{
+  return adr < hits_.size() ? hits_[adr] : 0;
+}
+
+inline void RvmProfile::dump(std::ostream& out, size_t top) const
+{
+  static const char* const movs[] = {
+    "reg <- num",      "",                "",                "",
+    "reg <- reg",      "",                "",                "",
+    "reg <- byte",     "reg <- word",     "reg <- dword",    "reg <- qword",
+    "byte <- reg",     "word <- reg",     "dword <- reg",    "qword <- reg"
+  };
+  static const char* const interrupts[] = { "putc", "puts", "getc", "halt" };
+
+  dump_table_(out, "opcodes", opcodes_, RvmIsa::mnemonics);
+  dump_table_(out, "mov", movs_, movs);
+  dump_table_(out, "interrupts", interrupts_, interrupts);
+
+  auto hot = sorted_(hits_);
+  out << "instructions (address: hits)\n";
+  for (size_t i = 0; i < hot.size() && i < top; i++) {
+    out << "  " << hot[i].second << ": " << hot[i].first << "\n";
+  }
+  out << "conditional jumps (address: taken / not taken)\n";
+  std::vector<uint64_t> jumps(taken_.size());
+  for (size_t adr = 0; adr < jumps.size(); adr++) {
+    jumps[adr] = taken_[adr] + not_taken_[adr];
+  }
+  for (auto [count, adr] : sorted_(jumps)) {
+    out << "  " << adr << ": " << taken_[adr] << " / " << not_taken_[adr] << "\n";
+  }
+}
+
+template <size_t N, class Name>
+void RvmProfile::dump_table_(std::ostream& out, const char* title, const std::array<uint64_t, N>& counters, const Name* names)
+{
+  out << title << "\n";
+  for (auto [count, i] : sorted_(std::vector<uint64_t>(counters.begin(), counters.end()))) {
+    out << "  " << names[i] << ": " << count << "\n";
+  }
+}
+
+//
+//  nonzero counters in descending order, each with its index
+//
+
+inline RvmProfile::counters_t RvmProfile::sorted_(const std::vector<uint64_t>& counters)
+{
+  counters_t result;
+  for (size_t i = 0; i < counters.size(); i++) {
+    if (counters[i]) {
+      result.emplace_back(counters[i], i);
+    }
+  }
+  std::stable_sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+    return a.first > b.first;
+  });
+  return result;
+}
+
+#endif // RVM_PROFILE_HPP
@@ -0,0 +1,313 @@
+#ifndef RVM_RECORD_HPP
+#define RVM_RECORD_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <iterator>
+#include <algorithm>
+
+//
+//  execution trace, written by RvmRecorder when Policy::recorded is set and
+//  checked by RvmReplayer when Policy::replayed is set. Numbers are LEB128
+//  varints. Stream starts with "RVMT", version byte and checkpoint interval,
+//  then records follow, each starts with varint head:
+//
+//    head & 3 == 0 - block entry, head >> 2 is zigzag delta of its address
+//                    from previous block entry
+//    head == 1     - GetC input, varint value follows
+//    head == 2     - checkpoint, varint index and registers follow
+//    head == 3     - end of program
+//
+//  Block entry is recorded after every jump, call, return and Ip write,
+//  first block of program is not recorded. Checkpoint follows every
+//  interval-th block entry
+//
+
+class RvmRecorder
+{
+public:
+
+  enum Tags : uint64_t
+  {
+    BlockTag,
+    InputTag,
+    CheckpointTag,
+    EndTag
+  };
+
+  static constexpr char Magic[] = { 'R', 'V', 'M', 'T', 1 };
+
+  RvmRecorder() = default;
+  RvmRecorder(const RvmRecorder&) = delete;
+  RvmRecorder& operator =(const RvmRecorder&) = delete;
+  ~RvmRecorder();
+
+  void open(std::ostream&, uint64_t = 4096);
+
+  bool block(uint64_t);
+  void input(uint64_t);
+  void checkpoint(const uint64_t*, size_t);
+  void finish();
+
+private:
+
+  void put_(uint64_t);
+  void flush_();
+
+  std::ostream* out_ = nullptr;
+  std::vector<uint8_t> buffer_{};
+  uint64_t interval_ = 0;
+  uint64_t blocks_ = 0;
+  uint64_t checkpoints_ = 0;
+  uint64_t last_ = 0;
+};
+
+inline RvmRecorder::~RvmRecorder()
+{
+  flush_();
+}
+
+inline void RvmRecorder::open(std::ostream& out, uint64_t interval)
+{
+  flush_();
+  out_ = &out;
+  interval_ = interval ? interval : 1;
+  blocks_ = checkpoints_ = last_ = 0;
+  buffer_.assign(std::begin(Magic), std::end(Magic));
+  put_(interval_);
+}
+
+//
+//  returns true if checkpoint is due
+//
+
+inline bool RvmRecorder::block(uint64_t adr)
+{
+  if (!out_) {
+    return false;
+  }
+  auto delta = static_cast<int64_t>(adr - last_);
+  last_ = adr;
+  put_((static_cast<uint64_t>(delta) << 1 ^ static_cast<uint64_t>(delta >> 63)) << 2 | BlockTag);
+  if (buffer_.size() >= 1 << 16) {
+    flush_();
+  }
+  return ++blocks_ % interval_ == 0;
+}
+
+inline void RvmRecorder::input(uint64_t value)
+{
+  if (out_) {
+    put_(InputTag);
+    put_(value);
+  }
+}
+
+inline void RvmRecorder::checkpoint(const uint64_t* registers, size_t count)
+{
+  put_(CheckpointTag);
+  put_(checkpoints_++);
+  for (size_t i = 0; i < count; i++) {
+    put_(registers[i]);
+  }
+}
+
+inline void RvmRecorder::finish()
+{
+  if (out_) {
+    put_(EndTag);
+    flush_();
+    out_->flush();
+  }
+}
+
+inline void RvmRecorder::put_(uint64_t x)
+{
+  while (x >= 0x80) {
+    buffer_.push_back(static_cast<uint8_t>(x) | 0x80);
+    x >>= 7;
+  }
+  buffer_.push_back(static_cast<uint8_t>(x));
+}
+
+inline void RvmRecorder::flush_()
+{
+  if (out_ && !buffer_.empty()) {
+    out_->write(reinterpret_cast<const char*>(buffer_.data()), buffer_.size());
+  }
+  buffer_.clear();
+}
+
+//
+//  RvmReplayer - checks that execution follows recorded trace and feeds
+//  recorded GetC input to it. Execution may be stopped at checkpoint:
+//  Rvm pauses there and can be resumed or stepped as usual
+//
+
+class RvmReplayer
+{
+public:
+
+  static constexpr uint64_t NoStop = ~uint64_t{ 0 };
+
+  bool open(std::istream&);
+  void stopAt(uint64_t);
+
+  bool block(uint64_t);
+  uint64_t input();
+  bool checkpoint(const uint64_t*, size_t);
+  bool finish();
+
+  bool failed() const noexcept;
+  const std::string& error() const noexcept;
+
+  //
+  //  registers stored in last checkpoint passed
+  //
+
+  const std::vector<uint64_t>& registers() const noexcept;
+  uint64_t checkpoints() const noexcept;
+
+private:
+
+  bool get_(uint64_t&);
+  bool fail_(const std::string&);
+
+  std::vector<uint8_t> trace_{};
+  size_t pos_ = 0;
+  uint64_t interval_ = 1;
+  uint64_t blocks_ = 0;
+  uint64_t checkpoints_ = 0;
+  uint64_t last_ = 0;
+  uint64_t stop_ = NoStop;
+  std::vector<uint64_t> registers_{};
+  std::string error_{};
+};
+
+inline bool RvmReplayer::open(std::istream& in)
+{
+  trace_.assign(std::istreambuf_iterator<char>{ in }, {});
+  pos_ = sizeof(RvmRecorder::Magic);
+  blocks_ = checkpoints_ = last_ = 0;
+  registers_.clear();
+  error_.clear();
+  if (trace_.size() < pos_ || !std::equal(std::begin(RvmRecorder::Magic), std::end(RvmRecorder::Magic), trace_.begin())) {
+    return fail_("not a trace");
+  }
+  if (!get_(interval_) || !interval_) {
+    return fail_("bad trace header");
+  }
+  return true;
+}
+
+inline void RvmReplayer::stopAt(uint64_t checkpoint)
+{
+  stop_ = checkpoint;
+}
+
+//
+//  returns true if checkpoint is due, false if it isn't or replay failed
+//
+
+inline bool RvmReplayer::block(uint64_t adr)
+{
+  uint64_t head;
+  if (failed() || !get_(head) || (head & 3) != RvmRecorder::BlockTag) {
+    return fail_("trace has no block at " + std::to_string(adr));
+  }
+  auto zigzag = head >> 2;
+  last_ += zigzag >> 1 ^ (~(zigzag & 1) + 1);
+  if (last_ != adr) {
+    return fail_("replay diverged: block " + std::to_string(adr) + " instead of " + std::to_string(last_));
+  }
+  return ++blocks_ % interval_ == 0;
+}
+
+inline uint64_t RvmReplayer::input()
+{
+  uint64_t head, value;
+  if (failed() || !get_(head) || head != RvmRecorder::InputTag || !get_(value)) {
+    fail_("trace has no input");
+    return ~uint64_t{ 0 };
+  }
+  return value;
+}
+
+//
+//  returns false if execution should stop: replay failed or stop
+//  checkpoint is reached
+//
+
+inline bool RvmReplayer::checkpoint(const uint64_t* registers, size_t count)
+{
+  uint64_t head, index;
+  if (!get_(head) || head != RvmRecorder::CheckpointTag || !get_(index) || index != checkpoints_) {
+    return fail_("trace has no checkpoint " + std::to_string(checkpoints_));
+  }
+  registers_.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    if (!get_(registers_[i])) {
+      return fail_("truncated checkpoint " + std::to_string(index));
+    }
+    if (registers_[i] != registers[i]) {
+      return fail_("replay diverged at checkpoint " + std::to_string(index) + ": register " + std::to_string(i));
+    }
+  }
+  ++checkpoints_;
+  return index != stop_;
+}
+
+inline bool RvmReplayer::finish()
+{
+  uint64_t head;
+  if (!failed() && (!get_(head) || head != RvmRecorder::EndTag)) {
+    fail_("replay diverged: program ended before trace");
+  }
+  return !failed();
+}
+
+inline bool RvmReplayer::failed() const noexcept
+{
+  return !error_.empty();
+}
+
+inline const std::string& RvmReplayer::error() const noexcept
+{
+  return error_;
+}
+
+inline const std::vector<uint64_t>& RvmReplayer::registers() const noexcept
+{
+  return registers_;
+}
+
+inline uint64_t RvmReplayer::checkpoints() const noexcept
+{
+  return checkpoints_;
+}
+
+inline bool RvmReplayer::get_(uint64_t& x)
+{
+  x = 0;
+  for (unsigned shift = 0; pos_ < trace_.size() && shift < 64; shift += 7) {
+    auto byte = trace_[pos_++];
+    x |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool RvmReplayer::fail_(const std::string& message)
+{
+  if (error_.empty()) {
+    error_ = message;
+  }
+  return false;
+}
+
+#endif // RVM_RECORD_HPP
@@ -0,0 +1,168 @@
+#ifndef RVM_SAMPLER_HPP
+#define RVM_SAMPLER_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+//
+//  RvmSymbols - names of code addresses, read from symbol map written by
+//  assembler: one "address name" pair per line
+//
+
+class RvmSymbols
+{
+public:
+
+  RvmSymbols() = default;
+  explicit RvmSymbols(std::istream&);
+
+  std::string name(uint64_t) const;
+
+private:
+
+  std::map<uint64_t, std::string> names_{};
+};
+
+inline RvmSymbols::RvmSymbols(std::istream& in)
+{
+  uint64_t adr;
+  std::string name;
+  while (in >> adr >> name) {
+    names_.emplace(adr, name);
+  }
+}
+
+//
+//  labeled address gets its label, others are written in hex
+//
+
+inline std::string RvmSymbols::name(uint64_t adr) const
+{
+  auto it = names_.find(adr);
+  if (it != names_.end()) {
+    return it->second;
+  }
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  do {
+    hex.insert(hex.begin(), digits[adr & 0xF]);
+    adr >>= 4;
+  } while (adr);
+  return "0x" + hex;
+}
+
+//
+//  RvmSampler - sampling call stack profiler, used by Rvm when
+//  Policy::sampled is set. Rvm keeps shadow stack of guest frames with
+//  call and ret: frame is entry address of called routine, bottom frame
+//  is program start. Current stack is sampled once per period executed
+//  instructions on average. Distance between samples is randomized, so
+//  loops with length dividing period are not always sampled at the same
+//  instruction. dump writes samples in folded stack format:
+//
+//    start;routine;subroutine count
+//
+//  which is input of flamegraph tools
+//
+
+class RvmSampler
+{
+public:
+
+  explicit RvmSampler(uint64_t = 1000);
+
+  void reset();
+  void period(uint64_t);
+
+  void call(uint64_t);
+  void ret();
+  void tick();
+
+  void dump(std::ostream&, const RvmSymbols& = {}) const;
+
+private:
+
+  uint64_t next_countdown_();
+
+  uint64_t period_;
+  uint64_t random_ = 0x9E3779B97F4A7C15;
+  uint64_t countdown_;
+  std::vector<uint64_t> frames_{};
+  std::map<std::vector<uint64_t>, uint64_t> samples_{};
+};
+
+inline RvmSampler::RvmSampler(uint64_t period) :
+  period_(period ? period : 1),
+  countdown_(period_)
+{
+  reset();
+}
+
+inline void RvmSampler::reset()
+{
+  countdown_ = next_countdown_();
+  frames_.assign(1, 0);
+  samples_.clear();
+}
+
+inline void RvmSampler::period(uint64_t period)
+{
+  period_ = period ? period : 1;
+  countdown_ = next_countdown_();
+}
+
+inline void RvmSampler::call(uint64_t entry)
+{
+  frames_.push_back(entry);
+}
+
+//
+//  guest may leave routine without ret or return from frame it never
+//  entered with call, bottom frame is never popped
+//
+
+inline void RvmSampler::ret()
+{
+  if (frames_.size() > 1) {
+    frames_.pop_back();
+  }
+}
+
+inline void RvmSampler::tick()
+{
+  if (--countdown_ == 0) {
+    countdown_ = next_countdown_();
+    ++samples_[frames_];
+  }
+}
+
+//
+//  uniform in [period / 2, period * 3 / 2], xorshift is enough here
+//
+
+inline uint64_t RvmSampler::next_countdown_()
+{
+  if (period_ == 1) {
+    return 1;
+  }
+  random_ ^= random_ << 13;
+  random_ ^= random_ >> 7;
+  random_ ^= random_ << 17;
+  return period_ / 2 + random_ % (period_ + 1);
+}
+
+inline void RvmSampler::dump(std::ostream& out, const RvmSymbols& symbols) const
+{
+  for (const auto& [frames, count] : samples_) {
+    for (size_t i = 0; i < frames.size(); i++) {
+      out << (i ? ";" : "") << symbols.name(frames[i]);
+    }
+    out << " " << count << "\n";
+  }
+}
+
+#endif // RVM_SAMPLER_HPP
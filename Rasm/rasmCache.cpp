@@ -0,0 +1,325 @@
+#include "rasmCache.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <system_error>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+  //
+  //  temp files of writers in other processes differ by pid, of writers in
+  //  this one by counter
+  //
+
+  std::atomic<uint64_t> tempCounter{ 0 };
+
+  uint64_t processId()
+  {
+#ifdef _WIN32
+    return static_cast<uint64_t>(_getpid());
+#else
+    return static_cast<uint64_t>(getpid());
+#endif
+  }
+
+  void put(std::ostream& out, uint64_t num, size_t bytes)
+  {
+    for (auto i = bytes; i > 0; i--) {
+      out.put(static_cast<char>(num >> (8 * (i - 1)) & 0xFF));
+    }
+  }
+
+  bool get(std::istream& in, uint64_t& num, size_t bytes)
+  {
+    num = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      auto c = in.get();
+      if (c == std::char_traits<char>::eof()) {
+        return false;
+      }
+      num = num << 8 | static_cast<uint8_t>(c);
+    }
+    return true;
+  }
+
+  //
+  //  SHA-256 as of FIPS 180-4
+  //
+
+  class Sha256
+  {
+  public:
+
+    void update(const uint8_t* data, size_t size)
+    {
+      for (size_t i = 0; i < size; i++) {
+        block_[used_++] = data[i];
+        if (used_ == sizeof(block_)) {
+          transform_();
+          used_ = 0;
+        }
+      }
+      length_ += size;
+    }
+
+    std::array<uint8_t, 32> finish()
+    {
+      auto bits = length_ * 8;
+      uint8_t pad = 0x80;
+      update(&pad, 1);
+      pad = 0;
+      while (used_ != 56) {
+        update(&pad, 1);
+      }
+      for (auto i = 8; i > 0; i--) {
+        block_[used_++] = static_cast<uint8_t>(bits >> (8 * (i - 1)));
+      }
+      transform_();
+      std::array<uint8_t, 32> digest;
+      for (size_t i = 0; i < digest.size(); i++) {
+        digest[i] = static_cast<uint8_t>(state_[i / 4] >> (24 - 8 * (i % 4)));
+      }
+      return digest;
+    }
+
+  private:
+
+    static uint32_t rotate_(uint32_t x, int n)
+    {
+      return x >> n | x << (32 - n);
+    }
+
+    void transform_()
+    {
+      static constexpr uint32_t k[64] = {
+        0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+        0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+        0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+        0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+        0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+        0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+        0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+        0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+      };
+      uint32_t w[64];
+      for (auto i = 0; i < 16; i++) {
+        w[i] = static_cast<uint32_t>(block_[4 * i]) << 24 | static_cast<uint32_t>(block_[4 * i + 1]) << 16
+          | static_cast<uint32_t>(block_[4 * i + 2]) << 8 | block_[4 * i + 3];
+      }
+      for (auto i = 16; i < 64; i++) {
+        auto s0 = rotate_(w[i - 15], 7) ^ rotate_(w[i - 15], 18) ^ w[i - 15] >> 3;
+        auto s1 = rotate_(w[i - 2], 17) ^ rotate_(w[i - 2], 19) ^ w[i - 2] >> 10;
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+      auto a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+      auto e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+      for (auto i = 0; i < 64; i++) {
+        auto t1 = h + (rotate_(e, 6) ^ rotate_(e, 11) ^ rotate_(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        auto t2 = (rotate_(a, 2) ^ rotate_(a, 13) ^ rotate_(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+      }
+      state_[0] += a;
+      state_[1] += b;
+      state_[2] += c;
+      state_[3] += d;
+      state_[4] += e;
+      state_[5] += f;
+      state_[6] += g;
+      state_[7] += h;
+    }
+
+    uint32_t state_[8] = {
+      0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+    };
+    uint8_t block_[64] = {};
+    size_t used_ = 0;
+    uint64_t length_ = 0;
+  };
+}
+
+RasmCache::RasmCache(std::filesystem::path directory) :
+  directory_(std::move(directory)),
+  usable_(prepare_(directory_))
+{
+}
+
+std::filesystem::path RasmCache::defaultDirectory()
+{
+#ifdef _WIN32
+  if (auto local = std::getenv("LOCALAPPDATA"); local && *local) {
+    return std::filesystem::path{ local } / "rasm";
+  }
+#else
+
+  //
+  //  relative $XDG_CACHE_HOME is invalid and ignored, as specification says
+  //
+
+  if (auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg == '/') {
+    return std::filesystem::path{ xdg } / "rasm";
+  }
+  if (auto home = std::getenv("HOME"); home && *home) {
+    return std::filesystem::path{ home } / ".cache" / "rasm";
+  }
+#endif
+  return {};
+}
+
+RasmTranslator::Status RasmCache::load(const std::string& source, RasmObject& object)
+{
+  std::ifstream fin{ source };
+  if (!fin.is_open()) {
+    return translator_.translate(fin, object);
+  }
+  std::string text{ std::istreambuf_iterator<char>{ fin }, {} };
+  auto digest = digest_(text);
+  std::filesystem::path path;
+  if (usable_) {
+    std::ostringstream name;
+    name << std::hex << std::setfill('0');
+    for (auto byte : digest) {
+      name << std::setw(2) << +byte;
+    }
+    name << ".ro";
+    path = directory_ / name.str();
+    if (read_(path, text, digest, object)) {
+      object.name = source;
+      ++hits_;
+      return { true, {} };
+    }
+  }
+
+  ++misses_;
+  auto status = translator_.translate(std::string_view{ text }, object);
+  object.name = source;
+  if (status && usable_) {
+    write_(path, text, digest, object);
+  }
+  return status;
+}
+
+uint64_t RasmCache::hits() const noexcept
+{
+  return hits_;
+}
+
+uint64_t RasmCache::misses() const noexcept
+{
+  return misses_;
+}
+
+//
+//  directory is created with mode 0700; existing one is used only if it is
+//  owned by user and nobody else may write there, it is made private then
+//
+
+bool RasmCache::prepare_(const std::filesystem::path& directory)
+{
+  if (directory.empty()) {
+    return false;
+  }
+  std::error_code error;
+  if (directory.has_parent_path()) {
+    std::filesystem::create_directories(directory.parent_path(), error);
+  }
+#ifdef _WIN32
+  std::filesystem::create_directory(directory, error);
+  return std::filesystem::is_directory(directory, error);
+#else
+  if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+    return false;
+  }
+  struct stat info;
+  if (lstat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid()
+    || (info.st_mode & (S_IWGRP | S_IWOTH))) {
+    return false;
+  }
+  return (info.st_mode & 0077) == 0 || chmod(directory.c_str(), 0700) == 0;
+#endif
+}
+
+RasmCache::digest_t RasmCache::digest_(const std::string& text)
+{
+  Sha256 sha;
+  sha.update(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+  return sha.finish();
+}
+
+//
+//  entry of other translator or other text is a miss as entry which is not
+//  there
+//
+
+bool RasmCache::read_(const std::filesystem::path& path, const std::string& text, const digest_t& digest,
+  RasmObject& object) const
+{
+  std::ifstream in{ path, std::ifstream::in | std::ifstream::binary };
+  if (!in.is_open()) {
+    return false;
+  }
+  char header[sizeof(EntryHeader)];
+  if (!in.read(header, sizeof(header)) || !std::equal(std::begin(header), std::end(header), std::begin(EntryHeader),
+    [](char c, uint8_t b) { return static_cast<uint8_t>(c) == b; })) {
+    return false;
+  }
+  uint64_t version;
+  uint64_t length;
+  if (!get(in, version, 2) || version != RasmTranslator::Version || !get(in, length, 8) || length != text.size()) {
+    return false;
+  }
+  digest_t stored;
+  if (!in.read(reinterpret_cast<char*>(stored.data()), static_cast<std::streamsize>(stored.size())) || stored != digest) {
+    return false;
+  }
+  return object.read(in);
+}
+
+//
+//  entry is written aside under name unique to writer and renamed, so cache
+//  never has half of it
+//
+
+void RasmCache::write_(const std::filesystem::path& path, const std::string& text, const digest_t& digest,
+  const RasmObject& object) const
+{
+  auto temp = path;
+  temp += "." + std::to_string(processId()) + "." + std::to_string(tempCounter++) + ".tmp";
+  std::error_code error;
+  {
+    std::ofstream out{ temp, std::ofstream::out | std::ofstream::binary };
+    out.write(reinterpret_cast<const char*>(EntryHeader), sizeof(EntryHeader));
+    put(out, RasmTranslator::Version, 2);
+    put(out, text.size(), 8);
+    out.write(reinterpret_cast<const char*>(digest.data()), static_cast<std::streamsize>(digest.size()));
+    object.write(out);
+    if (!out) {
+      error = std::make_error_code(std::errc::io_error);
+    }
+  }
+  if (!error) {
+    std::filesystem::rename(temp, path, error);
+  }
+  if (error) {
+    std::filesystem::remove(temp, error);
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef RASM_CACHE_HPP
+#define RASM_CACHE_HPP
+
+#include <array>
+#include <string>
+#include <filesystem>
+
+#include "rasmObject.hpp"
+#include "rasmTranslator.hpp"
+
+//
+//  RasmCache - directory of translated modules, keyed by digest of source
+//  text. Source is translated only if there is no module for its text yet,
+//  so unchanged sources of large project are just read back and linked.
+//  Cache is only a shortcut: module which can't be stored or read is
+//  translated again.
+//
+//  Cached module is used only if translator version, length and SHA-256 of
+//  source text stored with it match, file starts with EntryHeader:
+//
+//    translator version (16) | source length (64) | SHA-256 (256) | module
+//
+//  Directory is private to user (mode 0700), cache which directory isn't
+//  owned by user or is writable by others is not used at all
+//
+
+class RasmCache
+{
+public:
+
+  explicit RasmCache(std::filesystem::path);
+
+  //
+  //  per-user cache directory: $XDG_CACHE_HOME/rasm or ~/.cache/rasm,
+  //  %LOCALAPPDATA%\rasm on Windows
+  //
+
+  static std::filesystem::path defaultDirectory();
+
+  //
+  //  module of source file, named after it for link errors
+  //
+
+  RasmTranslator::Status load(const std::string&, RasmObject&);
+
+  uint64_t hits() const noexcept;
+  uint64_t misses() const noexcept;
+
+  static constexpr uint8_t EntryHeader[] = { 0xFF, 'R', 'C', 0x01 };
+
+private:
+
+  using digest_t = std::array<uint8_t, 32>;
+
+  static bool prepare_(const std::filesystem::path&);
+  static digest_t digest_(const std::string&);
+
+  bool read_(const std::filesystem::path&, const std::string&, const digest_t&, RasmObject&) const;
+  void write_(const std::filesystem::path&, const std::string&, const digest_t&, const RasmObject&) const;
+
+  std::filesystem::path directory_;
+  bool usable_ = false;
+  RasmTranslator translator_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+#endif // RASM_CACHE_HPP
@@ -1,74 +1,183 @@
 #include "rasmLexer.hpp"
 
-#include <functional>
+#include <array>
+#include <charconv>
+#include <iterator>
 
-namespace {
-  std::string readWhile(std::istream& stream, std::function<bool(char)> pred)
+#include "rvmIsa.hpp"
+
+namespace
+{
+  //
+  //  classes of characters, looked up in table instead of locale
+  //
+
+  enum CharClasses : uint8_t
   {
-    std::istream::sentry sentry{ stream };
-    if (!sentry) {
-      return {};
+    Alpha = 1, Digit = 2, Word = 4, Blank = 8, Space = 16
+  };
+
+  constexpr std::array<uint8_t, 256> charClasses = [] {
+    std::array<uint8_t, 256> classes{};
+    for (auto c = 'a'; c <= 'z'; c++) {
+      classes[c] = classes[c - 'a' + 'A'] = Alpha | Word;
     }
-    std::string res;
-    while (pred(stream.peek())) {
-      char c;
-      stream.get(c);
-      res += c;
+    for (auto c = '0'; c <= '9'; c++) {
+      classes[c] = Digit | Word;
     }
-    return res;
+    classes['_'] = Word;
+    classes['\n'] = classes['\v'] = classes['\f'] = Space;
+
+    //
+    //  carriage return of Windows line end is blank, so it is skipped
+    //
+
+    classes[' '] = classes['\t'] = classes['\r'] = Blank | Space;
+    return classes;
+  }();
+
+  bool is(char c, uint8_t charClass)
+  {
+    return charClasses[static_cast<uint8_t>(c)] & charClass;
   }
 
-  void dropWhile(std::istream& stream, std::function<bool(char)> pred)
+  using TokenType = RasmLexer::TokenType;
+
+  //
+  //  keywords are lowercase, lexeme is lowered before lookup. Instructions
+  //  are mnemonics of RvmIsa, jumps are its conditions. Mode is condition
+  //  of jump
+  //
+
+  struct keyword_t
   {
-    std::istream::sentry sentry{ stream };
-    if (!sentry) {
-      return;
+    std::string_view name;
+    TokenType type;
+    uint8_t code;
+    uint8_t mode;
+  };
+
+  constexpr std::string_view directives[] = { "db", "dw", "dd", "dq" };
+
+  constexpr size_t keywordCount = [] {
+    size_t count = std::size(RvmIsa::conditions) + RvmIsa::RegSize + std::size(RvmIsa::sizes) + std::size(directives) + 1;
+    for (auto format : RvmIsa::formats) {
+      count += format != RvmIsa::JumpFormat;
+    }
+    return count;
+  }();
+
+  constexpr std::array<keyword_t, keywordCount> keywords = [] {
+    std::array<keyword_t, keywordCount> table{};
+    size_t n = 0;
+    for (uint8_t op = 0; op < RvmIsa::OpcodeSize; op++) {
+      if (RvmIsa::formats[op] != RvmIsa::JumpFormat) {
+        table[n++] = { RvmIsa::mnemonics[op], TokenType::Instruction, op, 0 };
+      }
+    }
+    for (const auto& cond : RvmIsa::conditions) {
+      table[n++] = { cond.mnemonic, TokenType::Instruction, RvmIsa::Jmp, static_cast<uint8_t>(cond.neg << 2 | cond.mode) };
     }
-    while (pred(stream.peek())) {
-      stream.get();
+    for (uint8_t reg = 0; reg < RvmIsa::RegSize; reg++) {
+      table[n++] = { RvmIsa::registers[reg], TokenType::Register, reg, 0 };
     }
+    for (uint8_t size = 0; size < std::size(RvmIsa::sizes); size++) {
+      table[n++] = { RvmIsa::sizes[size], TokenType::Size, size, 0 };
+    }
+    for (uint8_t size = 0; size < std::size(directives); size++) {
+      table[n++] = { directives[size], TokenType::Data, size, 0 };
+    }
+    table[n++] = { "section", TokenType::Section, 0, 0 };
+    return table;
+  }();
+
+  //
+  //  lexeme is lowered to buffer on stack, no keyword is longer than it
+  //
+
+  constexpr size_t keywordLength = 8;
+
+  //
+  //  perfect hash of keywords: FNV-1a of lowered lexeme is multiplied by
+  //  odd seed, its top bits are slot. Seed is searched at compile time, so
+  //  that no two keywords share slot. Slot has index of keyword + 1, 0 if
+  //  it is empty
+  //
+
+  constexpr size_t slotBits = 9;
+
+  constexpr uint32_t hashStep(uint32_t hash, char c)
+  {
+    return (hash ^ static_cast<uint8_t>(c)) * 0x01000193;
   }
-}
 
+  constexpr uint32_t hashBasis = 0x811C9DC5;
+
+  constexpr size_t slotOf(uint32_t hash, uint32_t seed)
+  {
+    return static_cast<uint32_t>(hash * (2 * seed + 1)) >> (32 - slotBits);
+  }
 
-const std::unordered_map<CaseInsensitiveString, uint8_t> RasmLexer::registers_ = {
-  { "r0", 0  }, { "r1", 1 }, { "r2", 2  }, { "r3", 3  },
-  { "r4", 4  }, { "r5", 5 }, { "r6", 6  }, { "r7", 7  },
-  { "ir", 8  }, { "fg", 9 }, { "ip", 10 }, { "sp", 11 },
-  { "bp", 12 }
-};
-
-const std::unordered_map<CaseInsensitiveString, uint8_t> RasmLexer::binary_operators_ = {
-  { "add", 0  }, { "sub", 1  }, { "and", 2  },
-  { "or" , 3  }, { "xor", 4  }, { "not", 5  },
-  { "cmp", 13 }
-};
-
-const std::unordered_map<CaseInsensitiveString, uint8_t> RasmLexer::jumps_ = {
-  { "jmp", 0b000 }, { "jz", 0b010 },
-  { "jnz", 0b110 }, { "jp", 0b011 },
-  { "jnp", 0b111 }, { "jn", 0b001 },
-  { "jnn", 0b101 }, { "je", 0b010 },
-  { "jne", 0b110 }, { "jg", 0b011 },
-  { "jle", 0b111 }, { "jl", 0b001 },
-  { "jge", 0b101 }
-};
-
-const std::unordered_map<CaseInsensitiveString, std::pair<RasmLexer::TokenType, uint8_t>> RasmLexer::others_ = {
-  { "mov" , { TokenType::Mov, 6  }}, { "push", { TokenType::Push, 7  }},
-  { "pop" , { TokenType::Pop, 8  }}, { "call", { TokenType::Call, 10 }},
-  { "ret" , { TokenType::Ret, 11 }}, { "int",  { TokenType::Int , 12 }},
-  { "test", {TokenType::Test, 14 }}
-};
-
-const std::unordered_map<CaseInsensitiveString, uint8_t> RasmLexer::sizes_ = {
-  { "byte" , 0 }, { "word" , 1 },
-  { "dword", 2 }, { "qword", 3 }
-};
+  struct keywordHash_t
+  {
+    uint32_t seed;
+    std::array<uint8_t, size_t{ 1 } << slotBits> slots;
+  };
+
+  constexpr keywordHash_t keywordHash = [] {
+    keywordHash_t hash{};
+    for (uint32_t seed = 0; seed < 4096; seed++) {
+      hash = { seed, {} };
+      bool perfect = true;
+      for (size_t i = 0; i < keywords.size() && perfect; i++) {
+        auto key = hashBasis;
+        for (auto c : keywords[i].name) {
+          key = hashStep(key, c);
+        }
+        auto& slot = hash.slots[slotOf(key, seed)];
+        perfect = slot == 0;
+        slot = static_cast<uint8_t>(i + 1);
+      }
+      if (perfect) {
+        return hash;
+      }
+    }
+    return keywordHash_t{ ~0u, {} };
+  }();
+
+  static_assert(keywordHash.seed != ~0u, "no perfect hash of keywords");
+  static_assert(keywords.size() < 0xFF);
+  static_assert([] {
+    for (const auto& keyword : keywords) {
+      if (keyword.name.size() > keywordLength) {
+        return false;
+      }
+    }
+    return true;
+  }());
+
+  const keyword_t* findKeyword(std::string_view lex)
+  {
+    if (lex.size() > keywordLength) {
+      return nullptr;
+    }
+    char lower[keywordLength]{};
+    auto key = hashBasis;
+    for (size_t i = 0; i < lex.size(); i++) {
+      lower[i] = lex[i] >= 'A' && lex[i] <= 'Z' ? static_cast<char>(lex[i] - 'A' + 'a') : lex[i];
+      key = hashStep(key, lower[i]);
+    }
+    auto index = keywordHash.slots[slotOf(key, keywordHash.seed)];
+    if (index == 0 || keywords[index - 1].name != std::string_view{ lower, lex.size() }) {
+      return nullptr;
+    }
+    return &keywords[index - 1];
+  }
+}
 
 uint8_t RasmLexer::token_t::opcode() const
 {
-  return std::get<uint8_t>(data);
+  return std::get<std::pair<uint8_t, uint8_t>>(data).first;
 }
 
 std::pair<uint8_t, uint8_t> RasmLexer::token_t::opcodeAndMode() const
@@ -76,9 +185,33 @@ std::pair<uint8_t, uint8_t> RasmLexer::token_t::opcodeAndMode() const
   return std::get<std::pair<uint8_t, uint8_t>>(data);
 }
 
-std::string RasmLexer::token_t::lexeme() const
+std::string_view RasmLexer::token_t::lexeme() const
 {
-  return std::get<std::string>(data);
+  return std::get<std::string_view>(data);
+}
+
+//
+//  escapes are \n, \t, \0, \\ and \", lexer leaves only these in literal
+//
+
+std::string RasmLexer::token_t::string() const
+{
+  auto raw = lexeme();
+  std::string str;
+  str.reserve(raw.size());
+  for (size_t i = 0; i < raw.size(); i++) {
+    if (raw[i] != '\\' || i + 1 == raw.size()) {
+      str.push_back(raw[i]);
+      continue;
+    }
+    switch (raw[++i]) {
+    case 'n': str.push_back('\n'); break;
+    case 't': str.push_back('\t'); break;
+    case '0': str.push_back('\0'); break;
+    default: str.push_back(raw[i]);
+    }
+  }
+  return str;
 }
 
 uint8_t RasmLexer::token_t::registerId() const
@@ -96,28 +229,33 @@ uint8_t RasmLexer::token_t::size() const
   return std::get<uint8_t>(data);
 }
 
-RasmLexer::RasmLexer(std::ifstream& fin):
-  fin_(fin)
+RasmLexer::RasmLexer(std::string_view source, size_t row):
+  row_(row),
+  source_(source)
 {
-  if (!fin_) {
-    throw std::ios_base::failure{ "file input error." };
-  }
-  fin_ >> std::noskipws;
 }
 
-RasmLexer::~RasmLexer()
+RasmLexer::RasmLexer(std::istream& fin, size_t row):
+  row_(row)
 {
-  fin_ >> std::skipws;
+  if (!fin) {
+    throw std::ios_base::failure{ "file input error." };
+  }
+  text_.assign(std::istreambuf_iterator<char>{ fin }, {});
+  source_ = text_;
 }
 
 RasmLexer::token_t RasmLexer::getNextToken()
 {
-  dropWhile(fin_, [](char c) { return isblank(c); });
-  if (fin_.peek() == comment_mark_) {
-    dropWhile(fin_, [](char c) { return c != '\n'; });
+  while (pos_ < source_.size() && is(source_[pos_], Blank)) {
+    ++pos_;
+  }
+  if (pos_ < source_.size() && source_[pos_] == comment_mark_) {
+    auto eol = source_.find('\n', pos_);
+    pos_ = eol == std::string_view::npos ? source_.size() : eol;
   }
   token_t current;
-  fin_ >> current;
+  read_token_(current);
   if (current.type == TokenType::Eol) {
     ++row_;
   }
@@ -125,75 +263,105 @@ RasmLexer::token_t RasmLexer::getNextToken()
   return current;
 }
 
-std::istream& operator>>(std::istream& stream, RasmLexer::token_t& token)
+void RasmLexer::read_token_(token_t& token)
 {
-  std::istream::sentry sentry{ stream };
-  if (!sentry) {
-    token.type = RasmLexer::TokenType::Eof;
-    return stream;
+  if (pos_ >= source_.size()) {
+    token.type = TokenType::Eof;
+    return;
   }
-  if (isalpha(stream.peek())) {
-    auto lex = readWhile(stream, [](char c) { return isalpha(c) || isdigit(c) || c == '_'; });
-    if (RasmLexer::registers_.find(lex) != RasmLexer::registers_.end()) {
-      token.type = RasmLexer::TokenType::Register;
-      token.data = RasmLexer::registers_.at(lex);
-    } else if (RasmLexer::binary_operators_.find(lex) != RasmLexer::binary_operators_.end()) {
-      token.type = RasmLexer::TokenType::BinaryOperator;
-      token.data = RasmLexer::binary_operators_.at(lex);
-    } else if (RasmLexer::jumps_.find(lex) != RasmLexer::jumps_.end()) {
-      token.type = RasmLexer::TokenType::Jump;
-      token.data = std::pair{ 9, RasmLexer::jumps_.at(lex) };
-    } else if (RasmLexer::others_.find(lex) != RasmLexer::others_.end()) {
-      auto [t, c] = RasmLexer::others_.at(lex);
-      token.type = t;
-      token.data = c;
-    } else if (RasmLexer::sizes_.find(lex) != RasmLexer::sizes_.end()) {
-      token.type = RasmLexer::TokenType::Size;
-      token.data = RasmLexer::sizes_.at(lex);
+  auto start = pos_;
+  auto c = source_[pos_];
+  if (is(c, Alpha)) {
+    while (pos_ < source_.size() && is(source_[pos_], Word)) {
+      ++pos_;
+    }
+    auto lex = source_.substr(start, pos_ - start);
+    if (auto keyword = findKeyword(lex)) {
+      token.type = keyword->type;
+      if (keyword->type == TokenType::Instruction) {
+        token.data = std::pair{ keyword->code, keyword->mode };
+      } else {
+        token.data = keyword->code;
+      }
     } else {
-      token.type = RasmLexer::TokenType::Label;
+      token.type = TokenType::Label;
       token.data = lex;
     }
-  } else if (isdigit(stream.peek())) {
-    auto num = readWhile(stream, [](char c) { return isdigit(c); });
-    token.type = RasmLexer::TokenType::Integer;
-    token.data = std::stoull(num);
-  } else if (stream.peek() == std::char_traits<char>::eof()) {
-    token.type = RasmLexer::TokenType::Eof;
-  } else {
-    switch (stream.peek()) {
-    case '-':
-      token.type = RasmLexer::TokenType::Minus;
-      stream.get();
-      break;
-    case '+':
-      token.type = RasmLexer::TokenType::Plus;
-      stream.get();
-      break;
-    case ':':
-      token.type = RasmLexer::TokenType::Colon;
-      stream.get();
-      break;
-    case '[':
-      token.type = RasmLexer::TokenType::LeftPar;
-      stream.get();
-      break;
-    case ']':
-      token.type = RasmLexer::TokenType::RightPar;
-      stream.get();
-      break;
-    case '\n':
-      token.type = RasmLexer::TokenType::Eol;
-      stream.get();
-      break;
-    case ',':
-      token.type = RasmLexer::TokenType::Comma;
-      stream.get();
-      break;
-    default:
-      token.type = RasmLexer::TokenType::Unknown;
-      token.data = readWhile(stream, [](char c) { return !isspace(c); });
+    return;
+  }
+  if (is(c, Digit)) {
+    while (pos_ < source_.size() && is(source_[pos_], Digit)) {
+      ++pos_;
+    }
+    uint64_t num = 0;
+    if (std::from_chars(source_.data() + start, source_.data() + pos_, num).ec != std::errc{}) {
+      token.type = TokenType::Unknown;
+      token.data = source_.substr(start, pos_ - start);
+      return;
+    }
+    token.type = TokenType::Integer;
+    token.data = num;
+    return;
+  }
+  ++pos_;
+  switch (c) {
+  case '-':
+    token.type = TokenType::Minus;
+    break;
+  case '+':
+    token.type = TokenType::Plus;
+    break;
+  case ':':
+    token.type = TokenType::Colon;
+    break;
+  case '[':
+    token.type = TokenType::LeftPar;
+    break;
+  case ']':
+    token.type = TokenType::RightPar;
+    break;
+  case '\n':
+    token.type = TokenType::Eol;
+    break;
+  case ',':
+    token.type = TokenType::Comma;
+    break;
+  case '"': {
+    //
+    //  string literal of one line, its lexeme is between quotes and keeps
+    //  escapes, string() replaces them. Unterminated literal or unknown
+    //  escape is unknown token of literal as written
+    //
+    token.type = TokenType::String;
+    while (true) {
+      if (pos_ == source_.size() || source_[pos_] == '\n') {
+        token.type = TokenType::Unknown;
+        token.data = source_.substr(start, pos_ - start);
+        return;
+      }
+      c = source_[pos_++];
+      if (c == '"') {
+        break;
+      }
+      if (c == '\\' && pos_ < source_.size()) {
+        switch (source_[pos_++]) {
+        case 'n': case 't': case '0': case '\\': case '"':
+          break;
+        default:
+          token.type = TokenType::Unknown;
+        }
+      }
+    }
+    token.data = token.type == TokenType::String
+      ? source_.substr(start + 1, pos_ - start - 2)
+      : source_.substr(start, pos_ - start);
+    break;
+  }
+  default:
+    token.type = TokenType::Unknown;
+    while (pos_ < source_.size() && !is(source_[pos_], Space)) {
+      ++pos_;
     }
+    token.data = source_.substr(start, pos_ - start);
   }
-  return stream;
 }
@@ -1,13 +1,23 @@
 #ifndef RASM_LEXER_HPP
 #define RASM_LEXER_HPP
 
+#include <string>
 #include <variant>
-#include <unordered_map>
-#include <fstream>
+#include <istream>
 #include <optional>
+#include <string_view>
 
 #include "caseInsensitiveString.hpp"
 
+//
+//  RasmLexer - tokens of source in contiguous buffer. Lexemes are views into
+//  it, so buffer must outlive lexer and its tokens. Lexer of stream reads it
+//  to buffer of its own.
+//
+//  Instructions are keywords of RvmIsa: token of instruction has its opcode
+//  and, for jumps, condition as neg bit and mode (neg << 2 | mode)
+//
+
 class RasmLexer
 {
 public:
@@ -15,16 +25,11 @@ public:
   enum class TokenType
   {
     Size,
-    BinaryOperator,
-    Mov,
-    Push,
-    Pop,
-    Jump,
-    Ret,
-    Test,
-    Call,
-    Int,
+    Instruction,
+    Data,
+    Section,
     Integer,
+    String,
     Label,
     Register,
     Comma,
@@ -43,33 +48,42 @@ public:
   {
     [[nodiscard]] uint8_t opcode() const;
     [[nodiscard]] std::pair<uint8_t, uint8_t> opcodeAndMode() const;
-    [[nodiscard]] std::string lexeme() const;
+    [[nodiscard]] std::string_view lexeme() const;
+
+    //
+    //  characters of string literal with escapes replaced
+    //
+
+    [[nodiscard]] std::string string() const;
     [[nodiscard]] uint8_t registerId() const;
     [[nodiscard]] uint64_t integer() const;
     [[nodiscard]] uint8_t size() const;
 
     TokenType type = TokenType::None;
     size_t row = 0;
-    std::variant<uint8_t, std::pair<uint8_t, uint8_t>, std::string, uint64_t> data{};
+    std::variant<uint8_t, std::pair<uint8_t, uint8_t>, std::string_view, uint64_t> data{};
   };
 
-  friend std::istream& operator >>(std::istream&, token_t&);
+  //
+  //  rows are counted from given one, chunk of source starts in the middle
+  //
 
-  explicit RasmLexer(std::ifstream&);
-  ~RasmLexer();
+  explicit RasmLexer(std::string_view, size_t = 1);
+  explicit RasmLexer(std::istream&, size_t = 1);
+  RasmLexer(const RasmLexer&) = delete;
+  RasmLexer& operator =(const RasmLexer&) = delete;
   token_t getNextToken();
 
 private:
 
+  void read_token_(token_t&);
+
   size_t row_ = 1;
-  std::ifstream& fin_;
+  std::string text_;
+  std::string_view source_;
+  size_t pos_ = 0;
 
   const static char comment_mark_ = ';';
-  const static std::unordered_map<CaseInsensitiveString, uint8_t> binary_operators_;
-  const static std::unordered_map<CaseInsensitiveString, uint8_t> registers_;
-  const static std::unordered_map<CaseInsensitiveString, uint8_t> jumps_;
-  const static std::unordered_map<CaseInsensitiveString, uint8_t> sizes_;
-  const static std::unordered_map<CaseInsensitiveString, std::pair<TokenType, uint8_t>> others_;
 };
 
 #endif // RASM_LEXER_HPP
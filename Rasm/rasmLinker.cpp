@@ -0,0 +1,218 @@
+#include "rasmLinker.hpp"
+
+#include <thread>
+#include <iterator>
+#include <algorithm>
+
+#include "rvmIsa.hpp"
+
+void RasmLinker::optimize(bool on) noexcept
+{
+  optimize_ = on;
+}
+
+void RasmLinker::compact(bool on) noexcept
+{
+  compact_ = on;
+}
+
+void RasmLinker::threads(unsigned count) noexcept
+{
+  threads_ = count;
+}
+
+bool RasmLinker::link(const std::vector<RasmObject>& objects, std::ostream& out)
+{
+  std::vector<uint8_t> program;
+  if (!link(objects, program)) {
+    return false;
+  }
+  out.write(reinterpret_cast<const char*>(program.data()), static_cast<std::streamsize>(program.size()));
+  return true;
+}
+
+bool RasmLinker::link(const std::vector<RasmObject>& objects, std::vector<uint8_t>& program)
+{
+  errors_.clear();
+  symbols_.clear();
+  optimizer_ = {};
+
+  std::vector<uint8_t> code;
+  std::vector<uint8_t> data;
+  std::vector<std::pair<uint64_t, uint64_t>> bases;
+  exports_t exports;
+  for (const auto& object : objects) {
+    bases.emplace_back(code.size(), data.size());
+    for (const auto& symbol : object.symbols) {
+      auto base = symbol.section == RasmObject::CodeSection ? code.size() : data.size();
+      exports.insert({ symbol.name, { symbol.section, base + symbol.offset } });
+    }
+    code.insert(code.end(), object.code.begin(), object.code.end());
+    data.insert(data.end(), object.data.begin(), object.data.end());
+  }
+
+  //
+  //  modules are resolved independently, each patches only its own code.
+  //  Module m goes to thread m % workers
+  //
+
+  std::vector<resolved_t> resolved(objects.size());
+  auto workers = std::max<size_t>(std::min<size_t>(threads_, objects.size()), 1);
+  auto work = [&](size_t first) {
+    for (size_t m = first; m < objects.size(); m += workers) {
+      resolve_(objects[m], bases[m].first, bases[m].second, exports, code, resolved[m]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers; i++) {
+    threads.emplace_back(work, i);
+  }
+  work(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::vector<RasmOptimizer::relocation_t> relocations;
+  for (const auto& module : resolved) {
+    relocations.insert(relocations.end(), module.relocations.begin(), module.relocations.end());
+    errors_.insert(errors_.end(), module.errors.begin(), module.errors.end());
+  }
+  if (!errors_.empty()) {
+    return false;
+  }
+
+  std::vector<uint64_t> labels;
+  bool sectioned = !data.empty();
+  for (const auto& [name, placed] : exports) {
+    if (placed.section == RasmObject::CodeSection) {
+      labels.push_back(placed.adr);
+    } else {
+      sectioned = true;
+    }
+  }
+  std::vector<uint8_t> header;
+  if (optimize_ || compact_ || sectioned) {
+    uint64_t origin = sectioned ? RvmIsa::SectionedHeaderSize : compact_ ? sizeof(RvmIsa::CompactHeader) : 0;
+    code = optimizer_.run(code, labels, relocations, { optimize_, compact_, origin });
+
+    //
+    //  code which can't be decoded is left as is. That is fine for /O
+    //  alone, but behind header or in version 2 its jump targets and
+    //  addresses of labels would be wrong
+    //
+
+    if (!optimizer_.rewritten() && (compact_ || sectioned)) {
+      errors_.push_back("code can't be decoded, so it can't be laid out in format version "
+        + std::to_string(sectioned ? 3 : 2));
+      return false;
+    }
+    if (sectioned) {
+      header.assign(std::begin(RvmIsa::SectionedHeader), std::end(RvmIsa::SectionedHeader));
+      header.push_back(compact_ ? 2 : 1);
+      header.resize(8, 0);
+      for (uint64_t size : { code.size(), data.size() }) {
+        for (auto i = 1; i <= 4; i++) {
+          header.push_back(size >> (32 - 8 * i) & 0xFF);
+        }
+      }
+    } else if (compact_) {
+      header.assign(std::begin(RvmIsa::CompactHeader), std::end(RvmIsa::CompactHeader));
+    }
+  }
+  auto dataAdr = header.size() + code.size();
+  for (const auto& [name, placed] : exports) {
+    auto adr = placed.section == RasmObject::CodeSection ? optimizer_.address(placed.adr) : dataAdr + placed.adr;
+    symbols_.emplace_back(adr, name);
+  }
+
+  program.clear();
+  program.reserve(header.size() + code.size() + data.size());
+  program.insert(program.end(), header.begin(), header.end());
+  program.insert(program.end(), code.begin(), code.end());
+  program.insert(program.end(), data.begin(), data.end());
+  return true;
+}
+
+const std::vector<std::string>& RasmLinker::errors() const noexcept
+{
+  return errors_;
+}
+
+void RasmLinker::writeSymbols(std::ostream& stream) const
+{
+  auto symbols = symbols_;
+  std::sort(symbols.begin(), symbols.end());
+  for (const auto& [adr, label] : symbols) {
+    stream << adr << " " << label << "\n";
+  }
+}
+
+const RasmOptimizer::stats_t& RasmLinker::optimizationStats() const noexcept
+{
+  return optimizer_.stats();
+}
+
+//
+//  jump and call targets are put as code addresses. Immediate of mov is
+//  code address or data offset, RasmOptimizer moves both when it lays
+//  program out
+//
+
+void RasmLinker::resolve_(const RasmObject& object, uint64_t codeBase, uint64_t dataBase, const exports_t& exports,
+  std::vector<uint8_t>& code, resolved_t& resolved)
+{
+  auto error = [&](const std::string& message) {
+    resolved.errors.push_back(object.name.empty() ? message : object.name + ": " + message);
+  };
+  std::unordered_map<std::string, placed_t> locals;
+  for (const auto& symbol : object.symbols) {
+    auto base = symbol.section == RasmObject::CodeSection ? codeBase : dataBase;
+    locals.insert({ symbol.name, { symbol.section, base + symbol.offset } });
+  }
+  for (const auto& reloc : object.relocations) {
+    auto row = "at row " + std::to_string(reloc.row) + " ";
+    placed_t target{};
+    if (auto it = locals.find(reloc.label); it != locals.end()) {
+      target = it->second;
+    } else {
+      auto [l, h] = exports.equal_range(reloc.label);
+      if (l == h) {
+        error(row + "label \'" + reloc.label + "\' is not defined");
+        continue;
+      }
+      if (std::next(l) != h) {
+        error(row + "label \'" + reloc.label + "\' is defined in several modules");
+        continue;
+      }
+      target = l->second;
+    }
+    auto adr = codeBase + reloc.adr;
+    uint64_t field = 0;
+    switch (reloc.adr < object.code.size() ? code[adr] : 0xFF) {
+    case RvmIsa::Mov:
+      field = adr + 2;
+      resolved.relocations.emplace_back(adr, target.section == RasmObject::DataSection
+        ? RasmOptimizer::DataRelocation : RasmOptimizer::CodeRelocation);
+      break;
+    case RvmIsa::Jmp:
+      field = adr + 2;
+      break;
+    case RvmIsa::Call:
+      field = adr + 1;
+      break;
+    default:
+      error(row + "invalid relocation of label \'" + reloc.label + "\'");
+      continue;
+    }
+    if (field + 8 > codeBase + object.code.size()) {
+      error(row + "invalid relocation of label \'" + reloc.label + "\'");
+      continue;
+    }
+    if (code[adr] != RvmIsa::Mov && target.section == RasmObject::DataSection) {
+      error(row + "jump to data label \'" + reloc.label + "\'");
+      continue;
+    }
+    for (auto i = 1; i <= 8; i++) {
+      code[field + i - 1] = target.adr >> (64 - 8 * i) & 0xFF;
+    }
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef RASM_LINKER_HPP
+#define RASM_LINKER_HPP
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <unordered_map>
+
+#include "rasmObject.hpp"
+#include "rasmOptimizer.hpp"
+
+//
+//  RasmLinker - combines translated modules into runnable program. Code of
+//  modules is put one after another in given order, so is data. Label used
+//  in module is looked up in that module first, then among labels of all
+//  others, where it must be defined exactly once.
+//
+//  Linked program is written in format version 1, or laid out again by
+//  RasmOptimizer if it is optimized or compact. Program with data is
+//  written in sectioned format version 3 with RvmIsa::SectionedHeader, see
+//  Rvm::decode_. Its code is in version 1 or, if compact, 2
+//
+
+class RasmLinker
+{
+public:
+
+  void optimize(bool) noexcept;
+  void compact(bool) noexcept;
+
+  //
+  //  labels of modules are resolved on this many threads, 1 by default
+  //
+
+  void threads(unsigned) noexcept;
+
+  //
+  //  returns false if some label is not resolved, or if code has to be laid
+  //  out again (compact or sectioned) and can't be decoded. Program is not
+  //  written then, see errors()
+  //
+
+  bool link(const std::vector<RasmObject>&, std::ostream&);
+
+  //
+  //  links program to memory, as it would be written to stream
+  //
+
+  bool link(const std::vector<RasmObject>&, std::vector<uint8_t>&);
+
+  const std::vector<std::string>& errors() const noexcept;
+
+  //
+  //  symbol map of last link: "address label" per line, by address
+  //
+
+  void writeSymbols(std::ostream&) const;
+
+  const RasmOptimizer::stats_t& optimizationStats() const noexcept;
+
+private:
+
+  struct placed_t
+  {
+    RasmObject::Sections section;
+    uint64_t adr;
+  };
+
+  using exports_t = std::unordered_multimap<std::string, placed_t>;
+
+  //
+  //  relocated movs and errors of one module
+  //
+
+  struct resolved_t
+  {
+    std::vector<RasmOptimizer::relocation_t> relocations;
+    std::vector<std::string> errors;
+  };
+
+  static void resolve_(const RasmObject&, uint64_t, uint64_t, const exports_t&, std::vector<uint8_t>&, resolved_t&);
+
+  std::vector<std::pair<uint64_t, std::string>> symbols_;
+  std::vector<std::string> errors_;
+  RasmOptimizer optimizer_;
+  bool optimize_ = false;
+  bool compact_ = false;
+  unsigned threads_ = 1;
+};
+
+#endif // RASM_LINKER_HPP
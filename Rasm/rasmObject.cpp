@@ -0,0 +1,132 @@
+#include "rasmObject.hpp"
+
+#include <iterator>
+#include <algorithm>
+
+namespace
+{
+  void put(std::ostream& out, uint64_t num, size_t bytes)
+  {
+    for (auto i = bytes; i > 0; i--) {
+      out.put(static_cast<char>(num >> (8 * (i - 1)) & 0xFF));
+    }
+  }
+
+  void putName(std::ostream& out, const std::string& name)
+  {
+    put(out, name.size(), 2);
+    out.write(name.data(), static_cast<std::streamsize>(name.size()));
+  }
+
+  void putBytes(std::ostream& out, const std::vector<uint8_t>& bytes)
+  {
+    put(out, bytes.size(), 4);
+    out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+  }
+
+  bool get(std::istream& in, uint64_t& num, size_t bytes)
+  {
+    num = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      auto c = in.get();
+      if (c == std::char_traits<char>::eof()) {
+        return false;
+      }
+      num = num << 8 | static_cast<uint8_t>(c);
+    }
+    return true;
+  }
+
+  //
+  //  bytes left in stream, or as many as may be, if stream can't tell
+  //
+
+  uint64_t left(std::istream& in)
+  {
+    auto pos = in.tellg();
+    if (pos == std::istream::pos_type(-1)) {
+      return ~uint64_t{ 0 };
+    }
+    in.seekg(0, std::istream::end);
+    auto end = in.tellg();
+    in.seekg(pos);
+    return end == std::istream::pos_type(-1) || end < pos ? ~uint64_t{ 0 } : static_cast<uint64_t>(end - pos);
+  }
+
+  //
+  //  length is checked against bytes left before anything is allocated, so
+  //  damaged file is just not an object
+  //
+
+  template <class Container>
+  bool getSized(std::istream& in, Container& container, size_t lengthBytes, uint64_t& rest)
+  {
+    uint64_t length;
+    if (!get(in, length, lengthBytes) || length > rest) {
+      return false;
+    }
+    rest -= length;
+    container.resize(length);
+    in.read(reinterpret_cast<char*>(container.data()), static_cast<std::streamsize>(length));
+    return static_cast<uint64_t>(in.gcount()) == length;
+  }
+}
+
+void RasmObject::write(std::ostream& out) const
+{
+  out.write(reinterpret_cast<const char*>(ObjectHeader), sizeof(ObjectHeader));
+  putBytes(out, code);
+  putBytes(out, data);
+  put(out, symbols.size(), 4);
+  for (const auto& symbol : symbols) {
+    put(out, symbol.section, 1);
+    put(out, symbol.offset, 8);
+    put(out, symbol.row, 4);
+    putName(out, symbol.name);
+  }
+  put(out, relocations.size(), 4);
+  for (const auto& reloc : relocations) {
+    put(out, reloc.adr, 8);
+    put(out, reloc.row, 4);
+    putName(out, reloc.label);
+  }
+}
+
+bool RasmObject::read(std::istream& in)
+{
+  char header[sizeof(ObjectHeader)];
+  if (!in.read(header, sizeof(header)) || !std::equal(std::begin(header), std::end(header), std::begin(ObjectHeader),
+    [](char c, uint8_t b) { return static_cast<uint8_t>(c) == b; })) {
+    return false;
+  }
+  auto rest = left(in);
+  if (!getSized(in, code, 4, rest) || !getSized(in, data, 4, rest)) {
+    return false;
+  }
+  uint64_t count;
+  if (!get(in, count, 4)) {
+    return false;
+  }
+  symbols.clear();
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t section, offset, row;
+    std::string name;
+    if (!get(in, section, 1) || !get(in, offset, 8) || !get(in, row, 4) || !getSized(in, name, 2, rest) || section > DataSection) {
+      return false;
+    }
+    symbols.push_back({ std::move(name), static_cast<Sections>(section), offset, static_cast<size_t>(row) });
+  }
+  if (!get(in, count, 4)) {
+    return false;
+  }
+  relocations.clear();
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t adr, row;
+    std::string label;
+    if (!get(in, adr, 8) || !get(in, row, 4) || !getSized(in, label, 2, rest)) {
+      return false;
+    }
+    relocations.push_back({ adr, std::move(label), static_cast<size_t>(row) });
+  }
+  return true;
+}
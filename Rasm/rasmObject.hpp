@@ -0,0 +1,69 @@
+#ifndef RASM_OBJECT_HPP
+#define RASM_OBJECT_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+//
+//  RasmObject - translated module, input of RasmLinker. Code is in format
+//  version 1 and starts at address 0, data starts at offset 0 of its own
+//  section. Every label defined in module is exported. Every label used by
+//  jmp, call or mov is a relocation, its 8 byte field is zero until linker
+//  puts address there; label not defined in module is imported.
+//
+//  File starts with ObjectHeader, all numbers are big endian:
+//
+//    code size (32) | code | data size (32) | data
+//    symbol count (32) | { section (8) | offset (64) | row (32) | name }
+//    relocation count (32) | { address (64) | row (32) | name }
+//
+//  name is its length (16) and characters
+//
+
+struct RasmObject
+{
+  enum Sections : uint8_t
+  {
+    CodeSection, DataSection
+  };
+
+  struct symbol_t
+  {
+    std::string name;
+    Sections section;
+    uint64_t offset;
+    size_t row;
+  };
+
+  //
+  //  address is address of jmp, call or mov instruction in code
+  //
+
+  struct relocation_t
+  {
+    uint64_t adr;
+    std::string label;
+    size_t row;
+  };
+
+  static constexpr uint8_t ObjectHeader[] = { 0xFF, 'R', 'O', 2 };
+
+  void write(std::ostream&) const;
+
+  //
+  //  returns false if stream is not an object file or is truncated
+  //
+
+  bool read(std::istream&);
+
+  std::string name{};
+  std::vector<uint8_t> code{};
+  std::vector<uint8_t> data{};
+  std::vector<symbol_t> symbols{};
+  std::vector<relocation_t> relocations{};
+};
+
+#endif // RASM_OBJECT_HPP
@@ -0,0 +1,495 @@
+#include "rasmOptimizer.hpp"
+
+#include <iterator>
+#include <algorithm>
+
+//
+//  liveness is not searched further than this
+//
+
+static constexpr size_t scanLimit = 64;
+
+std::vector<uint8_t> RasmOptimizer::run(const std::vector<uint8_t>& code, const std::vector<uint64_t>& labels,
+  const std::vector<relocation_t>& relocations, options_t options)
+{
+  stats_ = {};
+  compact_ = options.compact;
+  origin_ = options.origin;
+  rewritten_ = decode_(code);
+  if (!rewritten_) {
+    code_.clear();
+    size_ = new_size_ = code.size();
+    return code;
+  }
+  for (auto [adr, relocation] : relocations) {
+    auto i = find_(adr);
+    if (i < code_.size() && code_[i].adr == adr && code_[i].op == Mov && code_[i].mode == 0b00) {
+      code_[i].relocation = relocation;
+    }
+  }
+  if (options.peephole && !uses_ip_) {
+    for (auto adr : labels) {
+      auto i = find_(adr);
+      if (i < code_.size()) {
+        code_[i].leader = true;
+      }
+    }
+    for (const auto& insn : code_) {
+      if ((insn.op == Jmp || insn.op == Call) && insn.imm != size_) {
+        code_[find_(insn.imm)].leader = true;
+      }
+    }
+    thread_jumps_();
+    for (int round = 0; round < 8; round++) {
+      bool changed = fold_movs_();
+      changed |= drop_tests_();
+      changed |= drop_dead_();
+      if (!changed) {
+        break;
+      }
+    }
+  }
+  do {
+    layout_();
+  } while (relax_());
+
+  std::vector<uint8_t> result;
+  result.reserve(new_size_ - origin_);
+  for (size_t i = 0; i < code_.size(); i++) {
+    if (!code_[i].removed) {
+      encode_(code_[i], addresses_[i], result);
+    }
+  }
+  stats_.bytes = static_cast<int64_t>(size_) - static_cast<int64_t>(new_size_ - origin_);
+  return result;
+}
+
+uint64_t RasmOptimizer::address(uint64_t adr) const
+{
+  if (!rewritten_) {
+    return adr;
+  }
+  auto i = find_(adr);
+  return i < code_.size() ? addresses_[i] : new_size_;
+}
+
+bool RasmOptimizer::rewritten() const noexcept
+{
+  return rewritten_;
+}
+
+const RasmOptimizer::stats_t& RasmOptimizer::stats() const noexcept
+{
+  return stats_;
+}
+
+//
+//  returns false if program can't be rewritten: it is malformed or jumps
+//  into the middle of instruction
+//
+
+bool RasmOptimizer::decode_(const std::vector<uint8_t>& code)
+{
+  code_.clear();
+  uses_ip_ = false;
+  size_ = code.size();
+  uint64_t adr = 0;
+  bool ok = true;
+  auto fetch = [&](size_t bytes) -> uint64_t {
+    if (bytes > size_ - adr) {
+      ok = false;
+      adr = size_;
+      return 0;
+    }
+    uint64_t num = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      num = num << 8 | code[adr++];
+    }
+    return num;
+  };
+  while (ok && adr < size_) {
+    instruction_t insn{};
+    insn.adr = adr;
+    insn.op = static_cast<uint8_t>(fetch(1));
+    auto byte = [&] { return fetch(1); };
+    auto number = [&](bool) { return fetch(8); };
+    if (!decode(insn, byte, number)) {
+      return false;
+    }
+    if (insn.dst >= RegSize || insn.src >= RegSize) {
+      return false;
+    }
+    uses_ip_ |= insn.dst == Ip || insn.src == Ip;
+    code_.push_back(insn);
+  }
+  if (!ok) {
+    return false;
+  }
+  for (const auto& insn : code_) {
+    if ((insn.op == Jmp || insn.op == Call) && insn.imm != size_) {
+      auto i = find_(insn.imm);
+      if (i == code_.size() || code_[i].adr != insn.imm) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//
+//  adr is address of instruction in new layout
+//
+
+void RasmOptimizer::encode_(const instruction_t& insn, uint64_t adr, std::vector<uint8_t>& out) const
+{
+  auto put = [&](uint64_t num) {
+    for (size_t i = compact_ ? size_t{ 1 } << insn.width : 8; i > 0; i--) {
+      out.push_back(num >> (8 * (i - 1)) & 0xFF);
+    }
+  };
+  auto target = [&] {
+    return compact_ ? address(insn.imm) - (adr + insn.length) : address(insn.imm);
+  };
+  auto start = out.size();
+  encode(insn, [&](uint8_t byte) { out.push_back(byte); }, [&](uint64_t, bool isTarget) {
+    put(isTarget ? target() : value_(insn));
+  });
+  if (compact_ && hasNumber(insn)) {
+    out[start] |= insn.width << 4;
+  }
+}
+
+//
+//  jump to unconditional jump goes straight to its target
+//
+
+void RasmOptimizer::thread_jumps_()
+{
+  for (auto& insn : code_) {
+    if (insn.op != Jmp && insn.op != Call) {
+      continue;
+    }
+    auto target = insn.imm;
+    for (int hops = 0; hops < 16; hops++) {
+      auto i = find_(target);
+      if (i == code_.size() || code_[i].op != Jmp || code_[i].mode != 0 || code_[i].imm == target) {
+        break;
+      }
+      target = code_[i].imm;
+    }
+    if (target != insn.imm) {
+      insn.imm = target;
+      ++stats_.jumps;
+    }
+  }
+}
+
+bool RasmOptimizer::fold_movs_()
+{
+  bool changed = false;
+  for (size_t i = 0; i < code_.size(); i = next_(i)) {
+    auto& insn = code_[i];
+    if (insn.removed || insn.op != Mov) {
+      continue;
+    }
+    if (insn.mode == 0b00 && insn.imm == 0 && insn.dst != Fg && !insn.relocation) {
+      insn.op = Xor;
+      insn.src = insn.dst;
+      insn.mode = 0;
+      changed = true;
+      continue;
+    }
+    if (insn.mode != 0b01 || insn.dst == Fg || insn.src == Fg) {
+      continue;
+    }
+    if (insn.dst == insn.src) {
+      if (dead_(i, -1, true)) {
+        remove_(i);
+        changed = true;
+      }
+      continue;
+    }
+    auto j = next_(i);
+    if (j == code_.size()) {
+      continue;
+    }
+    auto& second = code_[j];
+    if (second.leader || second.op != Mov || second.mode != 0b01 || second.src != insn.dst || second.dst == Fg) {
+      continue;
+    }
+    if (second.dst == insn.src) {
+      remove_(j);
+      changed = true;
+    } else if (second.dst != insn.dst && dead_(j, insn.dst, false)) {
+      second.src = insn.src;
+      remove_(i);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool RasmOptimizer::drop_tests_()
+{
+  bool changed = false;
+  for (size_t j = 0; j < code_.size(); j = next_(j)) {
+    auto& test = code_[j];
+    if (test.removed || test.op != Test || test.leader) {
+      continue;
+    }
+    auto i = previous_(j);
+    if (i < code_.size() && flags_source_(code_[i]) == test.src) {
+      remove_(j);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+//
+//  only writes without other effects are dropped, loads may fault
+//
+
+bool RasmOptimizer::drop_dead_()
+{
+  bool changed = false;
+  for (size_t i = 0; i < code_.size(); i = next_(i)) {
+    auto& insn = code_[i];
+    if (insn.removed || insn.dst >= Ir) {
+      continue;
+    }
+    if (insn.op <= Not || (insn.op == Mov && insn.mode <= 0b01)) {
+      if (dead_(i, insn.dst, true)) {
+        remove_(i);
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+//
+//  label of removed instruction moves to the next one
+//
+
+void RasmOptimizer::remove_(size_t i)
+{
+  code_[i].removed = true;
+  ++stats_.instructions;
+  auto j = next_(i);
+  if (code_[i].leader && j < code_.size()) {
+    code_[j].leader = true;
+  }
+}
+
+void RasmOptimizer::layout_()
+{
+  addresses_.resize(code_.size());
+  uint64_t adr = origin_;
+  for (size_t i = 0; i < code_.size(); i++) {
+    auto& insn = code_[i];
+    if (compact_ && insn.op != Jmp && insn.op != Call && !insn.relocation) {
+      insn.width = 0;
+      while (insn.width < 3 && insn.imm >> (8 << insn.width)) {
+        ++insn.width;
+      }
+    }
+    insn.length = length_(insn);
+    addresses_[i] = adr;
+    if (!insn.removed) {
+      adr += insn.length;
+    }
+  }
+  new_size_ = adr;
+}
+
+//
+//  widens relative jumps which don't reach their targets and relocated
+//  immediates which don't fit, returns true if any was widened. Widths
+//  only grow, so relaxation ends
+//
+
+bool RasmOptimizer::relax_()
+{
+  if (!compact_) {
+    return false;
+  }
+  bool grown = false;
+  for (size_t i = 0; i < code_.size(); i++) {
+    auto& insn = code_[i];
+    if (insn.removed) {
+      continue;
+    }
+    if (insn.relocation) {
+      while (insn.width < 3 && value_(insn) >> (8 << insn.width)) {
+        ++insn.width;
+        grown = true;
+      }
+      continue;
+    }
+    if (insn.op != Jmp && insn.op != Call) {
+      continue;
+    }
+    while (!fits_(static_cast<int64_t>(address(insn.imm) - (addresses_[i] + length_(insn))), insn.width)) {
+      ++insn.width;
+      grown = true;
+    }
+  }
+  return grown;
+}
+
+uint8_t RasmOptimizer::length_(const instruction_t& insn) const
+{
+  return length(insn, compact_ ? 1 << insn.width : 8);
+}
+
+uint64_t RasmOptimizer::value_(const instruction_t& insn) const
+{
+  switch (insn.relocation) {
+  case CodeRelocation:
+    return address(insn.imm);
+  case DataRelocation:
+    return new_size_ + insn.imm;
+  default:
+    return insn.imm;
+  }
+}
+
+size_t RasmOptimizer::next_(size_t i) const
+{
+  do {
+    ++i;
+  } while (i < code_.size() && code_[i].removed);
+  return i;
+}
+
+//
+//  code_.size() if there is no kept instruction before
+//
+
+size_t RasmOptimizer::previous_(size_t i) const
+{
+  while (i-- > 0) {
+    if (!code_[i].removed) {
+      return i;
+    }
+  }
+  return code_.size();
+}
+
+//
+//  instruction starting at or after address
+//
+
+size_t RasmOptimizer::find_(uint64_t adr) const
+{
+  auto it = std::lower_bound(code_.begin(), code_.end(), adr, [](const instruction_t& insn, uint64_t adr) {
+    return insn.adr < adr;
+  });
+  return it - code_.begin();
+}
+
+//
+//  true if register (-1 for none) and, if asked, flags are overwritten
+//  after instruction before they are read. Registers and flags left at the
+//  end of program are its result, they are live there
+//
+
+bool RasmOptimizer::dead_(size_t i, int reg, bool flags) const
+{
+  bool regDead = reg < 0;
+  bool flagsDead = !flags;
+  size_t scanned = 0;
+  for (i = next_(i); i < code_.size(); i = next_(i)) {
+    const auto& insn = code_[i];
+    if (barrier_(insn) || ++scanned > scanLimit) {
+      return false;
+    }
+    if ((!regDead && (reads_(insn) >> reg & 1)) || (!flagsDead && reads_flags_(insn))) {
+      return false;
+    }
+    regDead |= writes_(insn) == reg;
+    flagsDead |= sets_flags_(insn);
+    if (regDead && flagsDead) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint16_t RasmOptimizer::reads_(const instruction_t& insn)
+{
+  switch (insn.op) {
+  case Sub: [[fallthrough]];
+  case Xor:
+    return insn.dst == insn.src ? 0 : 1 << insn.dst | 1 << insn.src;
+  case Not:
+    return 1 << insn.src;
+  case Mov:
+    switch (insn.mode) {
+    case 0b00: return 0;
+    case 0b11: return 1 << insn.dst | 1 << insn.src;
+    default:   return 1 << insn.src;
+    }
+  case Push:
+    return 1 << insn.src | 1 << Sp;
+  case Pop:
+    return 1 << Sp;
+  case Test:
+    return 1 << insn.src;
+  default:
+    return 1 << insn.dst | 1 << insn.src;
+  }
+}
+
+//
+//  general register written, -1 if none
+//
+
+int RasmOptimizer::writes_(const instruction_t& insn)
+{
+  if (insn.op <= Not || insn.op == Pop || (insn.op == Mov && insn.mode != 0b11)) {
+    return insn.dst;
+  }
+  return -1;
+}
+
+bool RasmOptimizer::reads_flags_(const instruction_t& insn)
+{
+  return (insn.op == Jmp && insn.mode != 0) || (reads_(insn) >> Fg & 1);
+}
+
+bool RasmOptimizer::sets_flags_(const instruction_t& insn)
+{
+  return insn.op <= Mov || insn.op == Pop || insn.op == Cmp || insn.op == Test;
+}
+
+bool RasmOptimizer::barrier_(const instruction_t& insn)
+{
+  return insn.op == Jmp || insn.op == Call || insn.op == Ret || insn.op == Int || writes_(insn) == Fg;
+}
+
+bool RasmOptimizer::fits_(int64_t value, uint8_t width)
+{
+  if (width >= 3) {
+    return true;
+  }
+  auto limit = int64_t{ 1 } << ((8 << width) - 1);
+  return value >= -limit && value < limit;
+}
+
+//
+//  register flags are set from after instruction, -1 if flags are not
+//  a function of single register value
+//
+
+int RasmOptimizer::flags_source_(const instruction_t& insn)
+{
+  if (insn.op == Test) {
+    return insn.src;
+  }
+  if (insn.dst != Fg && (insn.op <= Not || insn.op == Pop || (insn.op == Mov && insn.mode != 0b11))) {
+    return insn.dst;
+  }
+  return -1;
+}
@@ -0,0 +1,139 @@
+#ifndef RASM_OPTIMIZER_HPP
+#define RASM_OPTIMIZER_HPP
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "rvmIsa.hpp"
+
+//
+//  RasmOptimizer - peephole pass over translated program, run by
+//  RasmTranslator before program is written. Works on decoded instructions:
+//
+//    mov r, 0            -> xor r, r
+//    mov a, b; mov b, a  -> mov a, b
+//    mov a, b; mov c, a  -> mov c, b              if a is dead after
+//    mov a, a            -> removed               if flags are dead after
+//    jmp L1 ... L1: jmp L2 -> jmp L2               for every jump and call
+//    op r, ...; test r   -> op r, ...             op sets flags from r
+//    op r, ...           -> removed               if r and flags are dead after
+//
+//  then lays out kept instructions again and moves jump targets. Pairs are
+//  not merged across label or jump target. Register or flags are dead if
+//  they are overwritten before read in straight line code that follows,
+//  anything is live at jump, call, ret, int or end of program.
+//  Programs reading or writing Ip depend on their code addresses, peephole
+//  pass leaves them as is.
+//
+//  Layout may also be compact, in format version 2 (see Rvm::decode_):
+//  immediates and offsets take 1, 2, 4 or 8 bytes, jumps and calls are
+//  relative. Every jump starts with 1 byte displacement and grows while it
+//  doesn't fit, until no jump grows.
+//
+//  Layout starts at origin, after header written by translator. Immediate
+//  of relocated mov is address of label: code address is moved as jump
+//  target, data offset is added to the end of code, where data follows
+//
+
+class RasmOptimizer : RvmIsa
+{
+public:
+
+  struct stats_t
+  {
+    uint64_t instructions = 0;
+    int64_t bytes = 0;
+    uint64_t jumps = 0;
+  };
+
+  struct options_t
+  {
+    bool peephole = true;
+    bool compact = false;
+    uint64_t origin = 0;
+  };
+
+  enum Relocations : uint8_t
+  {
+    NoRelocation, CodeRelocation, DataRelocation
+  };
+
+  using relocation_t = std::pair<uint64_t, Relocations>;
+
+  //
+  //  labels are addresses of all labels, they keep instructions they point
+  //  at from merging with previous ones. Relocations are addresses of movs
+  //  with label as immediate
+  //
+
+  std::vector<uint8_t> run(const std::vector<uint8_t>&, const std::vector<uint64_t>&,
+    const std::vector<relocation_t>&, options_t);
+
+  //
+  //  address in optimized program of given address in original one. Address
+  //  of removed instruction is mapped to next kept one
+  //
+
+  uint64_t address(uint64_t) const;
+
+  //
+  //  false if the last program couldn't be decoded: it is malformed or
+  //  jumps into the middle of instruction. It was returned as is then
+  //
+
+  bool rewritten() const noexcept;
+
+  const stats_t& stats() const noexcept;
+
+private:
+
+  struct instruction_t : fields_t
+  {
+    uint64_t adr;
+    uint8_t width;
+    uint8_t length;
+    uint8_t relocation;
+    bool leader;
+    bool removed;
+  };
+
+  bool decode_(const std::vector<uint8_t>&);
+  void encode_(const instruction_t&, uint64_t, std::vector<uint8_t>&) const;
+
+  void thread_jumps_();
+  bool fold_movs_();
+  bool drop_tests_();
+  bool drop_dead_();
+  void remove_(size_t);
+  void layout_();
+  bool relax_();
+  uint8_t length_(const instruction_t&) const;
+  uint64_t value_(const instruction_t&) const;
+
+  size_t next_(size_t) const;
+  size_t previous_(size_t) const;
+  size_t find_(uint64_t) const;
+  bool dead_(size_t, int, bool) const;
+
+  static uint16_t reads_(const instruction_t&);
+  static int writes_(const instruction_t&);
+  static bool reads_flags_(const instruction_t&);
+  static bool sets_flags_(const instruction_t&);
+  static bool barrier_(const instruction_t&);
+  static int flags_source_(const instruction_t&);
+  static bool fits_(int64_t, uint8_t);
+
+  std::vector<instruction_t> code_{};
+  std::vector<uint64_t> addresses_{};
+  uint64_t size_ = 0;
+  uint64_t new_size_ = 0;
+  uint64_t origin_ = 0;
+  bool rewritten_ = false;
+  bool compact_ = false;
+  bool uses_ip_ = false;
+  stats_t stats_{};
+};
+
+#endif // RASM_OPTIMIZER_HPP
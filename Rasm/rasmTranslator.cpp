@@ -1,8 +1,62 @@
 #include "rasmTranslator.hpp"
 
+#include <mutex>
+#include <atomic>
+#include <thread>
 #include <utility>
 #include <iomanip>
+#include <iterator>
 #include <algorithm>
+#include <exception>
+#include <unordered_set>
+
+namespace
+{
+  //
+  //  chunk of source for parallel translation is not shorter than this
+  //
+
+  constexpr size_t chunkBytes = 1 << 16;
+
+  //
+  //  whether data section is current after line [begin, end), if data is
+  //  current before it. Line switching section is "[label:]... section name"
+  //
+
+  bool dataAfter(std::string_view text, size_t begin, size_t end, bool data)
+  {
+    auto word = [&] {
+      while (begin < end && isblank(static_cast<unsigned char>(text[begin]))) {
+        ++begin;
+      }
+      auto start = begin;
+      if (begin < end && isalpha(static_cast<unsigned char>(text[begin]))) {
+        while (begin < end && (isalnum(static_cast<unsigned char>(text[begin])) || text[begin] == '_')) {
+          ++begin;
+        }
+      }
+      return CaseInsensitiveString{ std::string{ text.substr(start, begin - start) } };
+    };
+    while (true) {
+      auto head = word();
+      if (head == "") {
+        return data;
+      }
+      while (begin < end && isblank(static_cast<unsigned char>(text[begin]))) {
+        ++begin;
+      }
+      if (begin < end && text[begin] == ':') {
+        ++begin;
+        continue;
+      }
+      if (head != "section") {
+        return data;
+      }
+      auto name = word();
+      return name == "data" ? true : name == "code" ? false : data;
+    }
+  }
+}
 
 RasmTranslator::Status::Status(bool ok, std::vector<std::string> errors) :
   ok_(ok),
@@ -30,66 +84,294 @@ std::ostream& operator<<(std::ostream& stream, const RasmTranslator::Status& sta
 
 RasmTranslator::Status RasmTranslator::translate(std::ifstream& fin, std::ofstream& fout)
 {
-  if (!fin.is_open()) {
-    return { false, { "input error occured." } };
-  }
   if (!fout.is_open()) {
     return { false, { "output error occured."} };
   }
-  lexer_.reset(new RasmLexer{ fin });
+  if (!fin) {
+    return { false, { "input error occured." } };
+  }
+  std::string text{ std::istreambuf_iterator<char>{ fin }, {} };
+  std::vector<uint8_t> program;
+  auto status = translate(std::string_view{ text }, program);
+  if (status) {
+    fout.write(reinterpret_cast<const char*>(program.data()), static_cast<std::streamsize>(program.size()));
+  }
+  return status;
+}
+
+RasmTranslator::Status RasmTranslator::translate(std::string_view source, std::vector<uint8_t>& program)
+{
+  std::vector<RasmObject> objects(1);
+  auto status = threads_ > 1 ? translate_chunks_(source, objects) : translate(source, objects.front());
+  if (!status) {
+    return status;
+  }
+  return link(objects, program);
+}
+
+RasmTranslator::Status RasmTranslator::translate(std::istream& fin, RasmObject& object)
+{
+  if (!fin) {
+    return { false, { "input error occured." } };
+  }
+  std::string text{ std::istreambuf_iterator<char>{ fin }, {} };
+  return translate_(text, object, 1, false);
+}
+
+RasmTranslator::Status RasmTranslator::translate(std::string_view source, RasmObject& object)
+{
+  return translate_(source, object, 1, false);
+}
+
+//
+//  source starts at given row, in data section if asked
+//
+
+RasmTranslator::Status RasmTranslator::translate_(std::string_view source, RasmObject& object, size_t row, bool data)
+{
+  code_.clear();
+  labels_.clear();
+  data_.clear();
+  relocations_.clear();
+  errors_.clear();
+  has_errors_ = false;
+  in_data_ = data;
+  curr_ip_ = 0;
+  lexer_.reset(new RasmLexer{ source, row });
   if (!lexer_) {
     return { false, { "error occured while creating new lexer." } };
   }
   while (true) {
-    std::deque<Token> line;
+    auto& line = line_;
+    line.clear();
     Token current;
     while (current.type != TokenType::Eol && current.type != TokenType::Eof) {
       current = lexer_->getNextToken();
       if (current.type == TokenType::Unknown) {
-        log_error_("at row " + std::to_string(current.row) + " unexpected token \'" + current.lexeme() + "\'");
+        log_error_("at row " + std::to_string(current.row) + " unexpected token \'" + std::string{ current.lexeme() } + "\'");
         continue;
       }
       line.push_back(current);
     }
     handle_new_labels_(line);
-    if (line.empty() || line.size() == 1 && line.front().type == TokenType::Eol) {
+    if (line.empty() || (line.size() == 1 && line.front().type == TokenType::Eol)) {
       continue;
     }
     switch (line.front().type) {
-    case TokenType::BinaryOperator:
-      handle_arithmetic_(line);
+    case TokenType::Section:
+      handle_section_(line);
       break;
-    case TokenType::Jump: [[falthrough]]
-    case TokenType::Call:
-      handle_jumps_(line);
+    case TokenType::Data:
+      handle_data_(line);
       break;
-    case TokenType::Mov:
-      handle_mov_(line);
+    case TokenType::Eof:
       break;
     default:
-      handle_others_(line);
-    }
-    if (unresolved_labels_.empty()) {
-      write_(fout);
+      if (in_data_) {
+        log_error_("at row " + std::to_string(line.front().row) + " instruction in data section");
+        break;
+      }
+      if (line.front().type != TokenType::Instruction) {
+        handle_others_(line);
+        break;
+      }
+      switch (RvmIsa::formats[line.front().opcode()]) {
+      case RvmIsa::RegRegFormat:
+        handle_arithmetic_(line);
+        break;
+      case RvmIsa::JumpFormat: [[fallthrough]];
+      case RvmIsa::CallFormat:
+        handle_jumps_(line);
+        break;
+      case RvmIsa::MovFormat:
+        handle_mov_(line);
+        break;
+      default:
+        handle_others_(line);
+      }
     }
     if (line.back().type == TokenType::Eof) {
       break;
     }
   }
+
+  //
+  //  lexer refers to source, it must not outlive it
+  //
+
+  lexer_.reset();
+  object.code = std::move(code_);
+  object.data = data_;
+  object.symbols.clear();
+  for (const auto& [label, symbol] : labels_) {
+    object.symbols.push_back(symbol);
+  }
+  object.relocations = relocations_;
   return { !has_errors_, errors_ };
 }
 
-void RasmTranslator::try_resolve_label_(const std::string& label, uint64_t ip)
+//
+//  chunk starts at row and in section found by looking at beginnings of
+//  lines before it. Labels are global in source, so label defined in two
+//  chunks is redefined, though linker would take it as two labels
+//
+
+RasmTranslator::Status RasmTranslator::translate_chunks_(std::string_view source, std::vector<RasmObject>& objects)
 {
-  if (unresolved_labels_.find(label) != unresolved_labels_.end()) {
-    auto [l, h] = unresolved_labels_.equal_range(label);
-    std::for_each(l, h, [&](const std::pair<std::string, uint64_t>& kv) {
-      for (auto j = 0; j < 8; j++) {
-        byte_code_buffer_[kv.second + j] = ip >> (64 - 8 * (j + 1)) & 0xFF;
+  struct chunk_t
+  {
+    size_t begin;
+    size_t end;
+    size_t row;
+    bool data;
+  };
+  std::vector<chunk_t> chunks;
+  auto size = std::max(chunkBytes, source.size() / (threads_ * 4) + 1);
+  chunk_t chunk{ 0, 0, 1, false };
+  size_t row = 1;
+  bool data = false;
+  for (size_t pos = 0; pos < source.size();) {
+    auto eol = source.find('\n', pos);
+    eol = eol == std::string_view::npos ? source.size() : eol + 1;
+    data = dataAfter(source, pos, eol, data);
+    pos = eol;
+    ++row;
+    if (pos - chunk.begin >= size || pos == source.size()) {
+      chunk.end = pos;
+      chunks.push_back(chunk);
+      chunk = { pos, pos, row, data };
+    }
+  }
+  if (chunks.empty()) {
+    chunks.push_back(chunk);
+  }
+
+  objects.assign(chunks.size(), {});
+  std::vector<Status> statuses(chunks.size(), { true, {} });
+  std::atomic<size_t> next{ 0 };
+  std::exception_ptr failure;
+  std::mutex failureLock;
+  auto work = [&] {
+    try {
+      RasmTranslator translator;
+      for (auto i = next++; i < chunks.size(); i = next++) {
+        auto chunk = source.substr(chunks[i].begin, chunks[i].end - chunks[i].begin);
+        statuses[i] = translator.translate_(chunk, objects[i], chunks[i].row, chunks[i].data);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard{ failureLock };
+      failure = std::current_exception();
+      next = chunks.size();
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min<size_t>(threads_, chunks.size()); i++) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+
+  std::vector<std::string> errors;
+  for (const auto& status : statuses) {
+    errors.insert(errors.end(), status.errors_.begin(), status.errors_.end());
+  }
+  std::unordered_set<std::string> defined;
+  for (const auto& object : objects) {
+    for (const auto& symbol : object.symbols) {
+      if (!defined.insert(symbol.name).second) {
+        errors.push_back("at row " + std::to_string(symbol.row) + " label \'" + symbol.name + "\' was redefined");
       }
-    });
-    unresolved_labels_.erase(label);
+    }
   }
+  return { errors.empty(), errors };
+}
+
+RasmTranslator::Status RasmTranslator::link(const std::vector<RasmObject>& objects, std::ofstream& fout)
+{
+  if (!fout.is_open()) {
+    return { false, { "output error occured."} };
+  }
+  std::vector<uint8_t> program;
+  auto status = link(objects, program);
+  if (status) {
+    fout.write(reinterpret_cast<const char*>(program.data()), static_cast<std::streamsize>(program.size()));
+  }
+  return status;
+}
+
+RasmTranslator::Status RasmTranslator::link(const std::vector<RasmObject>& objects, std::vector<uint8_t>& program)
+{
+  linker_.optimize(optimize_);
+  linker_.compact(compact_);
+  linker_.threads(threads_);
+  auto ok = linker_.link(objects, program);
+  return { ok, linker_.errors() };
+}
+
+void RasmTranslator::writeSymbols(std::ostream& stream) const
+{
+  linker_.writeSymbols(stream);
+}
+
+void RasmTranslator::optimize(bool on) noexcept
+{
+  optimize_ = on;
+}
+
+const RasmOptimizer::stats_t& RasmTranslator::optimizationStats() const noexcept
+{
+  return linker_.optimizationStats();
+}
+
+void RasmTranslator::compact(bool on) noexcept
+{
+  compact_ = on;
+}
+
+void RasmTranslator::threads(unsigned count) noexcept
+{
+  threads_ = std::max(count, 1u);
+}
+
+bool RasmTranslator::line_t::empty() const noexcept
+{
+  return head == tokens.size();
+}
+
+size_t RasmTranslator::line_t::size() const noexcept
+{
+  return tokens.size() - head;
+}
+
+const RasmTranslator::Token& RasmTranslator::line_t::front() const
+{
+  return tokens[head];
+}
+
+const RasmTranslator::Token& RasmTranslator::line_t::back() const
+{
+  return tokens.back();
+}
+
+void RasmTranslator::line_t::pop_front() noexcept
+{
+  ++head;
+}
+
+void RasmTranslator::line_t::push_back(const Token& token)
+{
+  tokens.push_back(token);
+}
+
+void RasmTranslator::line_t::clear() noexcept
+{
+  tokens.clear();
+  head = 0;
 }
 
 void RasmTranslator::recover_()
@@ -107,7 +389,7 @@ void RasmTranslator::log_error_(const std::string& message)
   recover_();
 }
 
-bool RasmTranslator::check_head_type_(const std::deque<Token>& line, TokenType expected, const std::string& error)
+bool RasmTranslator::check_head_type_(const line_t& line, TokenType expected, const std::string& error)
 {
   if (line.empty() || line.front().type != expected) {
     log_error_(error);
@@ -116,7 +398,7 @@ bool RasmTranslator::check_head_type_(const std::deque<Token>& line, TokenType e
   return true;
 }
 
-bool RasmTranslator::check_end_of_line_(const std::deque<Token>& line, const std::string& error)
+bool RasmTranslator::check_end_of_line_(const line_t& line, const std::string& error)
 {
   if (!line.empty() && line.front().type != TokenType::Eol && line.front().type != TokenType::Eof) {
     log_error_(error);
@@ -125,20 +407,10 @@ bool RasmTranslator::check_end_of_line_(const std::deque<Token>& line, const std
   return true;
 }
 
-void RasmTranslator::write_(std::ofstream& fout)
-{
-  if (!has_errors_) {
-    std::for_each(byte_code_buffer_.begin(), byte_code_buffer_.end(), [&](uint8_t b) {
-      fout.write(reinterpret_cast<const char*>(&b), 1);
-    });
-  }
-  byte_code_buffer_.clear();
-}
-
-void RasmTranslator::handle_new_labels_(std::deque<Token>& line)
+void RasmTranslator::handle_new_labels_(line_t& line)
 {
   while (!line.empty() && line.front().type == TokenType::Label) {
-    auto label = line.front().lexeme();
+    std::string label{ line.front().lexeme() };
     auto row = line.front().row;
     line.pop_front();
     if (!check_head_type_(line, TokenType::Colon, ("at row " + std::to_string(row) + " unexpected token \'" + label + "\'"))) {
@@ -148,20 +420,41 @@ void RasmTranslator::handle_new_labels_(std::deque<Token>& line)
     if (labels_.find(label) != labels_.end()) {
       log_error_("at row " + std::to_string(row) + " label \'" + label + "\' was redefined");
     }
-    labels_.insert({ label, curr_ip_ });
-    try_resolve_label_(label, curr_ip_);
+    if (in_data_) {
+      labels_.insert({ label, { label, RasmObject::DataSection, data_.size(), row } });
+    } else {
+      labels_.insert({ label, { label, RasmObject::CodeSection, curr_ip_, row } });
+    }
   }
 }
 
-void RasmTranslator::handle_arithmetic_(std::deque<Token>& line)
+//
+//  instruction is written in format version 1, its numbers take 8 bytes
+//
+
+void RasmTranslator::emit_(const RvmIsa::fields_t& insn)
+{
+  auto byte = [&](uint8_t byte) {
+    code_.push_back(byte);
+  };
+  auto number = [&](uint64_t num, bool) {
+    for (auto i = 1; i <= 8; i++) {
+      code_.push_back(num >> (64 - 8 * i) & 0xFF);
+    }
+  };
+  RvmIsa::encode(insn, byte, number);
+  curr_ip_ += RvmIsa::length(insn, 8);
+}
+
+void RasmTranslator::handle_arithmetic_(line_t& line)
 {
-  auto fstByte = line.front().opcode();
+  RvmIsa::fields_t insn{ line.front().opcode() };
   auto row = std::to_string(line.front().row);
   line.pop_front();
   if (!check_head_type_(line, TokenType::Register, "at row " + row + " expected register after binary operator")) {
     return;
   }
-  uint8_t sndByte = line.front().registerId() << 4;
+  insn.dst = line.front().registerId();
   line.pop_front();
   if (!check_head_type_(line, TokenType::Comma, "at row " + row + " expected comma between registers")) {
     return;
@@ -170,59 +463,44 @@ void RasmTranslator::handle_arithmetic_(std::deque<Token>& line)
   if (!check_head_type_(line, TokenType::Register, "at row " + row + " expected two registers after binary operator")) {
     return;
   }
-  sndByte |= line.front().registerId();
+  insn.src = line.front().registerId();
   line.pop_front();
   if (!check_end_of_line_(line, "at row " + row + " unexpected token after binary operation")) {
     return;
   }
-  byte_code_buffer_.push_back(fstByte);
-  byte_code_buffer_.push_back(sndByte);
-  curr_ip_ += 2;
+  emit_(insn);
 }
 
-void RasmTranslator::handle_jumps_(std::deque<Token>& line)
+//
+//  jump or call to label, target is put by linker
+//
+
+void RasmTranslator::handle_jumps_(line_t& line)
 {
-  if (line.front().type == TokenType::Jump) {
-    auto [fstByte, sndByte] = line.front().opcodeAndMode();
-    sndByte <<= 5;
-    byte_code_buffer_.push_back(fstByte);
-    byte_code_buffer_.push_back(sndByte);
-    curr_ip_ += 10;
-  } else {
-    auto opcode = line.front().opcode();
-    byte_code_buffer_.push_back(opcode);
-    curr_ip_ += 9;
-  }
+  auto [opcode, condition] = line.front().opcodeAndMode();
+  RvmIsa::fields_t insn{ opcode };
+  insn.neg = condition >> 2 & 0x1;
+  insn.mode = condition & 0x3;
   auto row = std::to_string(line.front().row);
   line.pop_front();
   if (!check_head_type_(line, TokenType::Label, "at row " + row + " expected label after jump")) {
     return;
   }
-  auto label = line.front().lexeme();
+  relocations_.push_back({ curr_ip_, std::string{ line.front().lexeme() }, line.front().row });
   line.pop_front();
   if (!check_end_of_line_(line, "at row " + row + " unexpected token after jump statement")) {
     return;
   }
-  if (labels_.find(label) == labels_.end()) {
-    unresolved_labels_.insert({ label, byte_code_buffer_.size() });
-    for (auto i = 0; i < 8; i++) {
-      byte_code_buffer_.push_back(0);
-    }
-  } else {
-    auto dst = labels_.at(label);
-    for (auto i = 1; i <= 8; i++) {
-      byte_code_buffer_.push_back(dst >> (64 - 8 * i) & 0xFF);
-    }
-  }
+  emit_(insn);
 }
 
-void RasmTranslator::handle_mov_(std::deque<Token>& line)
+void RasmTranslator::handle_mov_(line_t& line)
 {
-  auto opcode = line.front().opcode();
+  RvmIsa::fields_t insn{ line.front().opcode() };
   auto row = std::to_string(line.front().row);
   line.pop_front();
   if (!line.empty() && line.front().type == TokenType::Register) {
-    auto dstReg = line.front().registerId();
+    insn.dst = line.front().registerId();
     line.pop_front();
     if (!check_head_type_(line, TokenType::Comma, "at row " + row + " expected move source after comma")) {
       return;
@@ -237,36 +515,39 @@ void RasmTranslator::handle_mov_(std::deque<Token>& line)
       }
     }
     if (!line.empty() && line.front().type == TokenType::Integer) {
-      auto num = line.front().integer();
+      insn.imm = line.front().integer();
       if (neg) {
-        num |= uint64_t(1) << 63;
+        insn.imm |= uint64_t(1) << 63;
       }
       line.pop_front();
       if (!check_end_of_line_(line, "at row " + row + " unexpected token after move statement")) {
         return;
       }
-      byte_code_buffer_.push_back(opcode);
-      byte_code_buffer_.push_back(0b00000000 | dstReg);
-      for (auto i = 1; i <= 8; i++) {
-        byte_code_buffer_.push_back(num >> (64 - 8 * i) & 0xFF);
+      emit_(insn);
+      return;
+    }
+    if (!neg && !line.empty() && line.front().type == TokenType::Label) {
+      relocations_.push_back({ curr_ip_, std::string{ line.front().lexeme() }, line.front().row });
+      line.pop_front();
+      if (!check_end_of_line_(line, "at row " + row + " unexpected token after move statement")) {
+        return;
       }
-      curr_ip_ += 10;
+      emit_(insn);
       return;
     }
     if (!line.empty() && line.front().type == TokenType::Register) {
-      auto srcReg = line.front().registerId();
+      insn.mode = 0b01;
+      insn.src = line.front().registerId();
       line.pop_front();
       if (!check_end_of_line_(line, "at row " + row + " unexpected token after move statement")) {
         return;
       }
-      byte_code_buffer_.push_back(opcode);
-      byte_code_buffer_.push_back(0b01000000 | dstReg);
-      byte_code_buffer_.push_back(srcReg << 4);
-      curr_ip_ += 3;
+      emit_(insn);
       return;
     }
     if (!line.empty() && line.front().type == TokenType::Size) {
-      auto size = line.front().size();
+      insn.mode = 0b10;
+      insn.size = line.front().size();
       line.pop_front();
       if (!check_head_type_(line, TokenType::LeftPar, "at row " + row + " expected move source address")) {
         return;
@@ -278,19 +559,15 @@ void RasmTranslator::handle_mov_(std::deque<Token>& line)
       if (!check_end_of_line_(line, "at row " + row + " unexpected token after move statement")) {
         return;
       }
-      auto [srcReg, offset] = optSrcOff.value();
-      byte_code_buffer_.push_back(opcode);
-      byte_code_buffer_.push_back(0b10000000 | dstReg | size << 4);
-      byte_code_buffer_.push_back(srcReg << 4);
-      for (auto i = 1; i <= 8; i++) {
-        byte_code_buffer_.push_back(offset >> (64 - 8 * i) & 0xFF);
-      }
-      curr_ip_ += 11;
+      insn.src = optSrcOff->first;
+      insn.imm = optSrcOff->second;
+      emit_(insn);
       return;
     }
     log_error_("at row " + row + " unexpected opcode and operands combination");
   } else if (!line.empty() && line.front().type == TokenType::Size) {
-    auto size = line.front().size();
+    insn.mode = 0b11;
+    insn.size = line.front().size();
     line.pop_front();
     if (!check_head_type_(line, TokenType::LeftPar, "at row " + row + " expected destination move address")) {
       return;
@@ -299,7 +576,8 @@ void RasmTranslator::handle_mov_(std::deque<Token>& line)
     if (!optDstOff) {
       return;
     }
-    auto [dstReg, offset] = optDstOff.value();
+    insn.dst = optDstOff->first;
+    insn.imm = optDstOff->second;
     if (!check_head_type_(line, TokenType::Comma, "at row" + row + " expected move source after comma")) {
       return;
     }
@@ -307,83 +585,134 @@ void RasmTranslator::handle_mov_(std::deque<Token>& line)
     if (!check_head_type_(line, TokenType::Register, "at row " + row + " expected move source register")) {
       return;
     }
-    auto srcReg = line.front().registerId();
+    insn.src = line.front().registerId();
     line.pop_front();
     if (!check_end_of_line_(line, "at row " + row + " unexpected token after move statement")) {
       return;
     }
-    byte_code_buffer_.push_back(opcode);
-    byte_code_buffer_.push_back(0b11000000 | dstReg | size << 4);
-    byte_code_buffer_.push_back(srcReg << 4);
-    for (auto i = 1; i <= 8; i++) {
-      byte_code_buffer_.push_back(offset >> (64 - 8 * i) & 0xFF);
-    }
-    curr_ip_ += 11;
+    emit_(insn);
   } else {
     log_error_("at row " + row + " expected move destination");
   }
 }
 
-void RasmTranslator::handle_others_(std::deque<Token>& line)
+void RasmTranslator::handle_others_(line_t& line)
 {
   auto row = std::to_string(line.front().row);
-  switch (line.front().type) {
-  case TokenType::Ret: {
-    byte_code_buffer_.push_back(line.front().opcode());
-    line.pop_front();
-    ++curr_ip_;
-    break;
+  if (line.front().type == TokenType::Eof) {
+    return;
   }
-  case TokenType::Int: {
-    byte_code_buffer_.push_back(line.front().opcode());
-    curr_ip_ += 2;
-    line.pop_front();
+  if (line.front().type != TokenType::Instruction) {
+    log_error_("at row " + row + " unexpected token found");
+    return;
+  }
+  RvmIsa::fields_t insn{ line.front().opcode() };
+  line.pop_front();
+  switch (RvmIsa::formats[insn.op]) {
+  case RvmIsa::ByteFormat:
     if (!check_head_type_(line, TokenType::Integer, "at row " + row + " expected interrupt id")) {
       return;
     }
-    byte_code_buffer_.push_back(line.front().integer());
+    insn.imm = line.front().integer();
     line.pop_front();
     break;
-  }
-  case TokenType::Test: {
-    byte_code_buffer_.push_back(line.front().opcode());
-    curr_ip_ += 2;
-    line.pop_front();
+  case RvmIsa::RegFormat:
     if (!check_head_type_(line, TokenType::Register, "at row " + row + " expected register to test")) {
       return;
     }
-    byte_code_buffer_.push_back(line.front().registerId() << 4);
+    insn.src = line.front().registerId();
     line.pop_front();
     break;
-  }
-  case TokenType::Push: [[falthrough]]
-  case TokenType::Pop: {
-    byte_code_buffer_.push_back(line.front().opcode());
-    curr_ip_ += 2;
-    line.pop_front();
+  case RvmIsa::StackFormat:
     if (!check_head_type_(line, TokenType::Size, "at row " + row + " expected size after push/pop")) {
       return;
     }
-    uint8_t sndByte = line.front().size() << 2;
+    insn.size = line.front().size();
     line.pop_front();
     if (!check_head_type_(line, TokenType::Register, "at row " + row + " expected register to push/pop")) {
       return;
     }
-    sndByte |= line.front().registerId() << 4;
+    insn.src = insn.dst = line.front().registerId();
     line.pop_front();
-    byte_code_buffer_.push_back(sndByte);
+    break;
+  default:
     break;
   }
-  case TokenType::Eof: return;
-  default: {
-    log_error_("at row " + row + " unexpected token found");
+  if (check_end_of_line_(line, "at row " + row + " unexpected token found")) {
+    emit_(insn);
+  }
+}
+
+//
+//  section code | section data
+//
+
+void RasmTranslator::handle_section_(line_t& line)
+{
+  auto row = std::to_string(line.front().row);
+  line.pop_front();
+  if (!check_head_type_(line, TokenType::Label, "at row " + row + " expected section name")) {
     return;
   }
+  CaseInsensitiveString name = std::string{ line.front().lexeme() };
+  line.pop_front();
+  if (name == "code") {
+    in_data_ = false;
+  } else if (name == "data") {
+    in_data_ = true;
+  } else {
+    log_error_("at row " + row + " unknown section \'" + name.data() + "\'");
+    return;
+  }
+  check_end_of_line_(line, "at row " + row + " unexpected token after section name");
+}
+
+//
+//  db | dw | dd | dq followed by comma separated integers and strings, each
+//  character of string takes one item of directive size. Items are big
+//  endian, as everything else in memory of machine
+//
+
+void RasmTranslator::handle_data_(line_t& line)
+{
+  auto size = line.front().size();
+  auto row = std::to_string(line.front().row);
+  line.pop_front();
+  if (!in_data_) {
+    log_error_("at row " + row + " data outside of data section");
+    return;
+  }
+  auto put = [&](uint64_t num) {
+    for (auto i = 1 << size; i > 0; i--) {
+      data_.push_back(num >> (8 * (i - 1)) & 0xFF);
+    }
+  };
+  while (true) {
+    if (!line.empty() && line.front().type == TokenType::String) {
+      for (auto c : line.front().string()) {
+        put(static_cast<uint8_t>(c));
+      }
+    } else if (!line.empty() && line.front().type == TokenType::Integer) {
+      auto num = line.front().integer();
+      if (size < 3 && num >> (8 << size)) {
+        log_error_("at row " + row + " integer doesn't fit in data item");
+        return;
+      }
+      put(num);
+    } else {
+      log_error_("at row " + row + " expected integer or string");
+      return;
+    }
+    line.pop_front();
+    if (line.empty() || line.front().type != TokenType::Comma) {
+      break;
+    }
+    line.pop_front();
   }
-  check_end_of_line_(line, "at row " + row + " unexpected token found");
+  check_end_of_line_(line, "at row " + row + " unexpected token after data");
 }
 
-std::optional<std::pair<uint8_t, int64_t>> RasmTranslator::get_reg_and_offset_(std::deque<Token>& line)
+std::optional<std::pair<uint8_t, int64_t>> RasmTranslator::get_reg_and_offset_(line_t& line)
 {
   auto row = std::to_string(line.front().row);
   line.pop_front();
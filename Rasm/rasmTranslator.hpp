@@ -1,12 +1,16 @@
 #ifndef RASM_TRANSLATOR_HPP
 #define RASM_TRANSLATOR_HPP
 
-#include <deque>
+#include <memory>
+#include <fstream>
 #include <vector>
 #include <unordered_map>
 #include <functional>
 
 #include "rasmLexer.hpp"
+#include "rasmObject.hpp"
+#include "rasmLinker.hpp"
+#include "rvmIsa.hpp"
 
 class RasmTranslator
 {
@@ -15,6 +19,13 @@ public:
   using Token = RasmLexer::token_t;
   using TokenType = RasmLexer::TokenType;
 
+  //
+  //  is changed whenever the same source is translated to another module,
+  //  so modules of older translator are not taken from RasmCache
+  //
+
+  static constexpr uint16_t Version = 1;
+
   class Status
   {
   public:
@@ -23,6 +34,7 @@ public:
     friend std::ostream& operator << (std::ostream&, const Status&);
   private:
     friend class RasmTranslator;
+    friend class RasmCache;
 
     Status(bool, std::vector<std::string>);
 
@@ -30,34 +42,131 @@ public:
     std::vector<std::string> errors_;
   };
 
+  //
+  //  translates source to runnable program, that is to module linked alone.
+  //  Program is built in memory and written at once
+  //
+
   Status translate(std::ifstream&, std::ofstream&);
 
+  //
+  //  translates source in memory to runnable program in memory, which may
+  //  be run by Rvm as RvmCode right away
+  //
+
+  Status translate(std::string_view, std::vector<uint8_t>&);
+
+  //
+  //  translates source to module with imported labels, which is linked with
+  //  others later
+  //
+
+  Status translate(std::istream&, RasmObject&);
+
+  //
+  //  translates source in memory to module, tokens are views into it
+  //
+
+  Status translate(std::string_view, RasmObject&);
+
+  //
+  //  links modules with RasmLinker, optimize and compact apply to it
+  //
+
+  Status link(const std::vector<RasmObject>&, std::ofstream&);
+  Status link(const std::vector<RasmObject>&, std::vector<uint8_t>&);
+
+  //
+  //  symbol map of last translation or link: "address label" per line, by
+  //  address
+  //
+
+  void writeSymbols(std::ostream&) const;
+
+  //
+  //  peephole optimization of program before it is written, off by default
+  //
+
+  void optimize(bool) noexcept;
+  const RasmOptimizer::stats_t& optimizationStats() const noexcept;
+
+  //
+  //  writes program in compact format version 2 instead of version 1
+  //
+
+  void compact(bool) noexcept;
+
+  //
+  //  translates source to file on this many threads, 1 by default. Source
+  //  is split into chunks at line boundaries, every chunk is translated to
+  //  module of its own, modules are linked. Program is the same as
+  //  translated on one thread
+  //
+
+  void threads(unsigned) noexcept;
+
 private:
 
+  //
+  //  tokens of line being translated, handlers take them from front. Buffer
+  //  is kept from line to line
+  //
+
+  struct line_t
+  {
+    bool empty() const noexcept;
+    size_t size() const noexcept;
+    const Token& front() const;
+    const Token& back() const;
+    void pop_front() noexcept;
+    void push_back(const Token&);
+    void clear() noexcept;
+
+    std::vector<Token> tokens{};
+    size_t head = 0;
+  };
+
+  Status translate_(std::string_view, RasmObject&, size_t, bool);
+  Status translate_chunks_(std::string_view, std::vector<RasmObject>&);
+
   void recover_();
   void log_error_(const std::string&);
-  bool check_head_type_(const std::deque<Token>&, TokenType, const std::string&);
-  bool check_end_of_line_(const std::deque<Token>&, const std::string&);
+  bool check_head_type_(const line_t&, TokenType, const std::string&);
+  bool check_end_of_line_(const line_t&, const std::string&);
+
+  void handle_new_labels_(line_t&);
+  void emit_(const RvmIsa::fields_t&);
+
+  void handle_arithmetic_(line_t&);
+  void handle_jumps_(line_t&);
+  void handle_mov_(line_t&);
+  void handle_others_(line_t&);
+  void handle_section_(line_t&);
+  void handle_data_(line_t&);
 
-  void write_(std::ofstream&);
-  void handle_new_labels_(std::deque<Token>&);
-  void try_resolve_label_(const std::string&, uint64_t);
+  std::optional<std::pair<uint8_t, int64_t>> get_reg_and_offset_(line_t&);
 
-  void handle_arithmetic_(std::deque<Token>&);
-  void handle_jumps_(std::deque<Token>&);
-  void handle_mov_(std::deque<Token>&);
-  void handle_others_(std::deque<Token>&);
 
-  std::optional<std::pair<uint8_t, int64_t>> get_reg_and_offset_(std::deque<Token>&);
+  //
+  //  code of module being translated. Label fields are left zero, their
+  //  places are in relocations_, linker patches them
+  //
 
-  std::deque<uint8_t> byte_code_buffer_;
-  std::unordered_map<std::string, uint64_t> labels_;
-  std::unordered_multimap<std::string, uint64_t> unresolved_labels_;
+  std::vector<uint8_t> code_;
+  line_t line_;
+  std::unordered_map<std::string, RasmObject::symbol_t> labels_;
+  std::vector<uint8_t> data_;
+  std::vector<RasmObject::relocation_t> relocations_;
 
   std::unique_ptr<RasmLexer> lexer_;
+  RasmLinker linker_;
 
   std::vector<std::string> errors_;
   bool has_errors_ = false;
+  bool optimize_ = false;
+  bool compact_ = false;
+  bool in_data_ = false;
+  unsigned threads_ = 1;
   uint64_t curr_ip_    = 0;
 };
 